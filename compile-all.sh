@@ -1,26 +1,49 @@
 #!/bin/bash
 
 #
-# Test compile for all supported architectures
+# Test compile for all supported architectures: each target is compiled with
+# virtual functions and with LOW_POWER_STATIC_DISPATCH to report the flash
+# and RAM savings
 #
 
+LOG="compile-all-log.txt"
+
+function compile_variant {
+    ARCH=$1
+    FILE=$2
+    DISPATCH=$3
+    OUT=$(arduino-cli compile -b "$ARCH" --build-property "compiler.cpp.extra_flags=-DLOW_POWER_STATIC_DISPATCH=$DISPATCH" "$FILE" 2>&1)
+    EC=$?
+    echo "$OUT"
+    FLASH=$(echo "$OUT" | grep -o "Sketch uses [0-9]*" | grep -o "[0-9]*")
+    RAM=$(echo "$OUT" | grep -o "Global variables use [0-9]*" | grep -o "[0-9]*")
+    echo -e "$ARCH $FILE static-dispatch=$DISPATCH -> rc=$EC flash=$FLASH ram=$RAM" >> "$LOG"
+}
+
 function compile_example {
     ARCH=$1
     FILE="./examples/wakeup-pin"
     # take action on each file. $f store current file name
-    arduino-cli compile -b "$ARCH" "$FILE"
-    EC=$?
-    echo -e "$ARCH $FILE -> rc=$EC" >> "compile-all-log.txt"
+    compile_variant "$ARCH" "$FILE" 0
+    FLASH_VIRTUAL=$FLASH
+    RAM_VIRTUAL=$RAM
+    compile_variant "$ARCH" "$FILE" 1
+    if [ -n "$FLASH_VIRTUAL" ] && [ -n "$FLASH" ] && [ -n "$RAM_VIRTUAL" ] && [ -n "$RAM" ]; then
+        echo -e "$ARCH $FILE static-dispatch savings -> flash=$((FLASH_VIRTUAL - FLASH)) ram=$((RAM_VIRTUAL - RAM))" >> "$LOG"
+    else
+        echo -e "$ARCH $FILE static-dispatch savings -> n/a" >> "$LOG"
+    fi
 }
 
-rm compile-all-log.txt
-compile_example "esp32:esp32:esp32" 
-compile_example "esp32:esp32:esp32c3" 
-compile_example "esp32:esp32:esp32s3" 
-compile_example "esp32:esp32:esp32s2" 
-compile_example "esp32:esp32:esp32c6" 
-compile_example "esp32:esp32:esp32h2" 
-compile_example "esp8266:esp8266:generic" 
-compile_example "rp2040:rp2040:generic" 
+rm "$LOG"
+compile_example "esp32:esp32:esp32"
+compile_example "esp32:esp32:esp32c3"
+compile_example "esp32:esp32:esp32s3"
+compile_example "esp32:esp32:esp32s2"
+compile_example "esp32:esp32:esp32c6"
+compile_example "esp32:esp32:esp32h2"
+compile_example "esp8266:esp8266:generic"
+compile_example "rp2040:rp2040:generic"
 compile_example "arduino:samd:arduino_zero_native"
-#compile_example "STMicroelectronics:stm32:GenF4" 
+compile_example "attiny:avr:ATtinyX5:cpu=attiny85,clock=internal8"
+#compile_example "STMicroelectronics:stm32:GenF4"
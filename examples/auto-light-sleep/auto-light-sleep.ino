@@ -0,0 +1,31 @@
+/**
+ * @brief ESP32 example which lets the power management enter the light sleep
+ * whenever FreeRTOS is idle: we do not need any explicit sleep calls. The
+ * time critical part is protected by a PowerLock which keeps the CPU at the
+ * max frequency.
+ * Requires a framework which was built with CONFIG_PM_ENABLE and
+ * CONFIG_FREERTOS_USE_TICKLESS_IDLE.
+ * @author Phil Schatzmann
+ */
+#include "LowPower.h"
+
+PowerLock cpu_lock(ESP_PM_CPU_FREQ_MAX, "measure");
+
+void measure() {
+  PowerLockGuard guard(cpu_lock);
+  Serial.println("measuring at the max cpu frequency");
+}
+
+void setup() {
+  Serial.begin(115200);
+  // scale between 80 and 240 MHz and sleep when idle
+  if (!LowPower.setAutomaticSleep(240, 80, true)) {
+    Serial.println("automatic light sleep not supported");
+  }
+}
+
+void loop() {
+  measure();
+  // the chip sleeps while we wait
+  delay(1000);
+}
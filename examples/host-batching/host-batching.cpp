@@ -0,0 +1,54 @@
+/**
+ * @brief Simulates one day of sensor readings every 10 s on the desktop (e.g.
+ * Linux): the readings are collected in a RetainedBuffer and the radio is
+ * only powered when 30 readings are available or the oldest reading is older
+ * than 10 minutes. Every 100th transmission fails, so that the readings are
+ * kept for the next attempt.
+ *
+ * Compile and run with:
+ *   g++ -O2 -I../../src host-batching.cpp -o host-batching
+ *   ./host-batching
+ *
+ * @author Phil Schatzmann
+ */
+
+#include "LowPower.h"
+
+const uint64_t sec_us = 1000000;
+const uint64_t day_us = 24ull * 60 * 60 * sec_us;
+
+struct Reading {
+  uint32_t time_s;
+  int16_t temperature;
+};
+
+LP_RETAINED RetainedBuffer<Reading, 32> readings;
+long radio_count = 0, sent_count = 0, sample_count = 0;
+
+bool send(const Reading *data, uint16_t count, void *) {
+  radio_count++;
+  if (radio_count % 100 == 0) return false;
+  sent_count += count;
+  return true;
+}
+
+int main() {
+  Serial.setActive(false);
+  LowPower.setSleepMode(sleep_mode_enum_t::deepSleep);
+  LowPower.setSleepTime(10, time_unit_t::sec);
+
+  while (LowPower.nowUs() < day_us) {
+    // in a deep sleep this is executed in setup() after each restart
+    readings.begin(send, 30, 600 * sec_us);
+    uint64_t now_us = LowPower.nowUs();
+    Reading reading{(uint32_t)(now_us / sec_us), (int16_t)(now_us % 300)};
+    readings.add(reading, now_us);
+    sample_count++;
+    LowPower.sleep();
+  }
+
+  printf("readings: %ld\n", sample_count);
+  printf("sent readings: %ld\n", sent_count);
+  printf("radio on: %ld times instead of %ld\n", radio_count, sample_count);
+  return 0;
+}
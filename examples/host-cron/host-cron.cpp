@@ -0,0 +1,73 @@
+/**
+ * @brief Tests the CronSchedule on the desktop (e.g. Linux): the fire times
+ * of some cron expressions are compared with a check of every minute of the
+ * years 2024 - 2028. Then we use the virtual clock of the host backend to
+ * sleep until 06:00 and 18:00 on the weekdays for two weeks.
+ *
+ * Compile and run with:
+ *   g++ -O2 -I../../src host-cron.cpp -o host-cron
+ *   ./host-cron
+ *
+ * @author Phil Schatzmann
+ */
+
+#include "LowPower.h"
+
+const char *specs[] = {"0 6,18 * * 1-5", "*/15 * * * *",
+                       "30 2 29 2 *",    "0 12 13 * 5",
+                       "5/20 8-10 1,15 * 0", "0 0 31 * *"};
+const int64_t start = 1704067200;  // 2024-01-01 00:00:00
+const int64_t end = start + (5 * 365 + 2) * 86400ll;
+
+/// Compares each field of a minute with the bitmasks of the schedule
+class CheckedSchedule : public CronSchedule {
+ public:
+  using CronSchedule::CronSchedule;
+
+  bool isMatch(int64_t epoch) {
+    civil_time_t ct;
+    epochToCivil(epoch, ct);
+    bool is_day = days >> ct.day & 1;
+    bool is_weekday = weekdays >> ct.dotw & 1;
+    return (minutes >> ct.min & 1) && (hours >> ct.hour & 1) &&
+           (months >> ct.month & 1) &&
+           (is_day_or ? is_day || is_weekday : is_day && is_weekday);
+  }
+};
+
+long test(const char *spec) {
+  CheckedSchedule schedule;
+  if (!schedule.begin(spec)) {
+    printf("invalid: %s\n", spec);
+    return 1;
+  }
+  long errors = 0, fires = 0;
+  int64_t next = schedule.next(start - 60);
+  for (int64_t t = start; t < end; t += 60) {
+    if (!schedule.isMatch(t)) continue;
+    fires++;
+    if (next != t) errors++;
+    next = schedule.next(t);
+  }
+  printf("%-20s fires: %6ld errors: %ld\n", spec, fires, errors);
+  return errors;
+}
+
+int main() {
+  long errors = 0;
+  for (const char *spec : specs) errors += test(spec);
+
+  // sleep until the next fire time with the virtual clock
+  LowPower.setSleepMode(sleep_mode_enum_t::deepSleep);
+  LowPower.setEpoch(start);
+  CronSchedule schedule("0 6,18 * * 1-5");
+  const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  while (LowPower.getEpoch() < start + 14 * 86400) {
+    if (!LowPower.sleepUntilNext(schedule)) break;
+    civil_time_t ct;
+    epochToCivil(LowPower.getEpoch(), ct);
+    printf("wakeup: %s %d-%02d-%02d %02d:%02d:%02d\n", days[ct.dotw],
+           ct.year, ct.month, ct.day, ct.hour, ct.min, ct.sec);
+  }
+  return errors == 0 ? 0 : 1;
+}
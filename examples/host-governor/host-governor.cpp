@@ -0,0 +1,54 @@
+/**
+ * @brief Simulates one hour of bursty pin wakeups on the desktop (e.g.
+ * Linux): every 30 s we get a burst of 50 pulses which are 5 ms apart (e.g.
+ * from a rotary encoder). The governor learns the short intervals within the
+ * bursts and selects the light sleep for them, while it uses the deep sleep
+ * between the bursts.
+ *
+ * Compile and run with:
+ *   g++ -O2 -I../../src host-governor.cpp -o host-governor
+ *   ./host-governor
+ *
+ * @author Phil Schatzmann
+ */
+
+#include "LowPower.h"
+
+const uint64_t sec_us = 1000000;
+const uint64_t hour_us = 3600 * sec_us;
+const int encoder_pin = 4;
+
+LowPowerGovernor governor;
+
+int main() {
+  Serial.setActive(false);
+  LowPower.setSleepTime(10, time_unit_t::sec);
+  LowPower.addWakeupPin(encoder_pin, pin_change_t::on_high);
+  LowPower.setGovernor(governor);
+  LowPower.setActive(false);
+
+  // bursts of 50 pulses every 30 s
+  for (uint64_t t = 30 * sec_us; t < hour_us; t += 30 * sec_us) {
+    for (int j = 0; j < 50; j++) {
+      uint64_t press_us = t + j * 5000;
+      LowPower.simulation().addPinEvent(encoder_pin, HIGH, press_us);
+      LowPower.simulation().addPinEvent(encoder_pin, LOW, press_us + 1000);
+    }
+  }
+
+  while (LowPower.nowUs() < hour_us) {
+    LowPower.process();
+  }
+
+  const sleep_statistics_t &stats = LowPower.statistics();
+  printf("sleep calls: %lu\n", (unsigned long)stats.sleep_count);
+  printf("light / deep sleep: %lu / %lu ms\n",
+         (unsigned long)(stats.residency_us[(int)sleep_mode_enum_t::lightSleep] /
+                         1000),
+         (unsigned long)(stats.residency_us[(int)sleep_mode_enum_t::deepSleep] /
+                         1000));
+  printf("predictions: %lu\n", (unsigned long)governor.statistics().predictions);
+  printf("hit ratio: %.1f %%\n", governor.hitRatio() * 100);
+  printf("mean abs error: %lu us\n", (unsigned long)governor.meanAbsErrorUs());
+  return 0;
+}
@@ -0,0 +1,43 @@
+/**
+ * @brief Simulates one day with three periodic jobs on the desktop (e.g.
+ * Linux): sensor read every 2 s, radio report every 60 s and housekeeping
+ * every hour. The slack windows allow the scheduler to merge the deadlines,
+ * so that we need fewer wakeups than jobs executions.
+ *
+ * Compile and run with:
+ *   g++ -O2 -I../../src host-scheduler.cpp -o host-scheduler
+ *   ./host-scheduler
+ *
+ * @author Phil Schatzmann
+ */
+
+#include "LowPower.h"
+
+const uint64_t sec_us = 1000000;
+const uint64_t day_us = 24ull * 60 * 60 * sec_us;
+
+LowPowerScheduler scheduler;
+long sensor_count = 0, report_count = 0, housekeeping_count = 0;
+
+void readSensor(void *) { sensor_count++; }
+void report(void *) { report_count++; }
+void housekeeping(void *) { housekeeping_count++; }
+
+int main() {
+  Serial.setActive(false);
+  scheduler.addJob(readSensor, 2 * sec_us, 500000);
+  scheduler.addJob(report, 60 * sec_us, 5 * sec_us);
+  scheduler.addJob(housekeeping, 3600 * sec_us, 60 * sec_us);
+  LowPower.setScheduler(scheduler);
+
+  while (LowPower.nowUs() < day_us) {
+    LowPower.process();
+  }
+
+  printf("sensor / report / housekeeping: %ld / %ld / %ld\n", sensor_count,
+         report_count, housekeeping_count);
+  printf("job executions: %lu\n", (unsigned long)scheduler.executionCount());
+  printf("wakeups: %lu\n", (unsigned long)scheduler.runCount());
+  printf("sleep calls: %lu\n", (unsigned long)LowPower.statistics().sleep_count);
+  return 0;
+}
@@ -0,0 +1,61 @@
+/**
+ * @brief Simulates one year of 10 second wake cycles on the desktop (e.g.
+ * Linux) using the virtual clock of the host backend. A button press is
+ * injected once a day to demonstrate the wakeup by pin: the button presses
+ * are collected from the wake event queue.
+ *
+ * Compile and run with:
+ *   g++ -O2 -I../../src host-simulation.cpp -o host-simulation
+ *   ./host-simulation
+ *
+ * @author Phil Schatzmann
+ */
+
+#include <chrono>
+
+#include "LowPower.h"
+
+const uint64_t day_us = 24ull * 60 * 60 * 1000000;
+const uint64_t year_us = 365 * day_us;
+const int button_pin = 4;
+
+int main() {
+  // setup low power definition
+  LowPower.setSleepMode(sleep_mode_enum_t::deepSleep);
+  LowPower.setSleepTime(10, time_unit_t::sec);
+  LowPower.addWakeupPin(button_pin, pin_change_t::on_high);
+
+  // press the button once a day for 100ms
+  for (uint64_t t = day_us / 2; t < year_us; t += day_us) {
+    LowPower.simulation().addPinEvent(button_pin, HIGH, t);
+    LowPower.simulation().addPinEvent(button_pin, LOW, t + 100000);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  long button_presses = 0;
+  while (LowPower.simulation().nowUs() < year_us) {
+    if (!LowPower.sleep()) break;
+    wake_event_t event;
+    while (LowPower.wakeEvents().pop(event)) {
+      if (event.pin == button_pin && event.level == HIGH) button_presses++;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  printf("simulated days: %lu\n",
+         (unsigned long)(LowPower.simulation().nowUs() / day_us));
+  const sleep_statistics_t &stats = LowPower.statistics();
+  printf("sleep calls: %lu\n", (unsigned long)stats.sleep_count);
+  printf("deep sleep: %lu sec\n",
+         (unsigned long)(stats.residency_us[(int)sleep_mode_enum_t::deepSleep] /
+                         1000000));
+  printf("timer / pin wakeups: %lu / %lu\n",
+         (unsigned long)stats.wakeup_count[(int)wakeup_cause_t::timer],
+         (unsigned long)stats.wakeup_count[(int)wakeup_cause_t::pin]);
+  printf("button presses: %ld (lost: %u)\n", button_presses,
+         LowPower.wakeEvents().overflows());
+  printf("runtime: %ld ms\n",
+         (long)std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+             .count());
+  return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @brief Tests the integer epoch conversion of LowPowerTime.h against
+ * timegm() and gmtime_r() of the C library on the desktop (e.g. Linux): we
+ * check every day of the years 0 - 4095 (the range of the RP2040 RTC) and
+ * a random time of each day. Then we compare the speed with mktime() and
+ * localtime_r() which are used by most Arduino sketches.
+ *
+ * Compile and run with:
+ *   g++ -O2 -I../../src host-time.cpp -o host-time
+ *   ./host-time
+ *
+ * @author Phil Schatzmann
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <chrono>
+
+#include "LowPower.h"
+
+const int max_year = 4095;
+
+bool isEqual(const civil_time_t &ct, const struct tm &ti) {
+  return ct.year == ti.tm_year + 1900 && ct.month == ti.tm_mon + 1 &&
+         ct.day == ti.tm_mday && ct.dotw == ti.tm_wday &&
+         ct.hour == ti.tm_hour && ct.min == ti.tm_min && ct.sec == ti.tm_sec;
+}
+
+/// compares the conversions in both directions for each day
+long test() {
+  long errors = 0, days = 0;
+  int64_t start = daysFromCivil(0, 1, 1);
+  int64_t end = daysFromCivil(max_year, 12, 31);
+  for (int64_t day = start; day <= end; day++, days++) {
+    time_t epoch = (time_t)(day * 86400 + rand() % 86400);
+    struct tm ti;
+    gmtime_r(&epoch, &ti);
+    civil_time_t ct;
+    epochToCivil(epoch, ct);
+    if (!isEqual(ct, ti) || civilToEpoch(ct) != (int64_t)timegm(&ti)) {
+      if (errors++ < 10)
+        printf("error: %lld -> %d-%02d-%02d %02d:%02d:%02d\n",
+               (long long)epoch, ct.year, ct.month, ct.day, ct.hour, ct.min,
+               ct.sec);
+    }
+  }
+  printf("checked days: %ld (years 0 - %d), errors: %ld\n", days, max_year,
+         errors);
+  return errors;
+}
+
+/// average time of a round trip epoch -> date -> epoch in ns: the day of
+/// the week is mixed in, so that the compiler can not drop the conversion
+template <typename F>
+double benchmark(F roundTrip) {
+  const long count = 1000000;
+  int64_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long j = 0; j < count; j++) {
+    sum += roundTrip((time_t)(1700000000 + j * 7919));
+  }
+  auto end = std::chrono::steady_clock::now();
+  // use the result, so that the loop is not removed
+  if (sum == 0) printf("-");
+  return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+int main() {
+  setenv("TZ", "UTC", 1);
+  tzset();
+  long errors = test();
+
+  double libc_ns = benchmark([](time_t epoch) {
+    struct tm ti;
+    localtime_r(&epoch, &ti);
+    ti.tm_isdst = -1;
+    return (int64_t)mktime(&ti) ^ ti.tm_wday;
+  });
+  double civil_ns = benchmark([](time_t epoch) {
+    civil_time_t ct;
+    return civilToEpoch(epochToCivil(epoch, ct)) ^ ct.dotw;
+  });
+  printf("localtime_r() + mktime(): %.1f ns\n", libc_ns);
+  printf("epochToCivil() + civilToEpoch(): %.1f ns\n", civil_ns);
+  return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+/**
+ * @brief Tests an ULP threshold monitor on the desktop (e.g. Linux): we
+ * simulate one day of temperature readings which are sampled every second by
+ * the ULP program. At noon the heating fails for 10 minutes. With a count
+ * of 3 the main processor is only woken up when 3 consecutive readings are
+ * outside of the window, so that the short noise spikes are ignored. The
+ * same program can be started on an ESP32 with
+ * LowPower.addWakeupULP(program, 1000000).
+ *
+ * Compile and run with:
+ *   g++ -O2 -I../../src host-ulp.cpp -o host-ulp
+ *   ./host-ulp
+ *
+ * @author Phil Schatzmann
+ */
+
+#include <math.h>
+
+#include "LowPower.h"
+
+const uint16_t low = 1000, high = 3000;
+const long day_s = 24l * 60 * 60;
+long second = 0;
+
+/// slow daily cycle with a noise spike every 97 seconds
+uint16_t temperature(ulp_source_t source, uint8_t channel, void *ref) {
+  double value = 2000 + 800 * sin(2 * M_PI * second / day_s);
+  if (second % 97 == 0) value += 1500;
+  if (second >= day_s / 2 && second < day_s / 2 + 600) value = 500;
+  return (uint16_t)value;
+}
+
+void simulate(uint16_t count) {
+  UlpProgram program;
+  if (!program.thresholdMonitor(ulp_source_t::adc, 6, low, high, count)) {
+    printf("program too long\n");
+    return;
+  }
+  UlpInterpreter ulp;
+  ulp.begin(temperature);
+
+  long wakeups = 0, errors = 0;
+  uint64_t cycles = 0;
+  for (second = 0; second < day_s; second++) {
+    ulp_result_t result = ulp.run(program);
+    cycles += result.cycles;
+    if (result.is_error) errors++;
+    if (result.is_wakeup) wakeups++;
+  }
+
+  printf("count: %d\n", count);
+  printf("  instructions: %d\n", program.size());
+  printf("  errors: %ld\n", errors);
+  printf("  main processor woken up: %ld times for %ld samples\n", wakeups,
+         day_s);
+  printf("  ULP cycles per sample: %.1f (%.1f us at 8 MHz)\n",
+         (double)cycles / day_s, (double)cycles / day_s / 8);
+}
+
+int main() {
+  simulate(1);
+  simulate(3);
+  return 0;
+}
@@ -0,0 +1,25 @@
+/**
+ * @brief Example which executes multiple periodic jobs: process() sleeps
+ * between the jobs and merges the deadlines which fall into the slack
+ * windows, so that we wake up as seldom as possible.
+ * @author Phil Schatzmann
+ */
+#include "LowPower.h"
+
+LowPowerScheduler scheduler;
+
+void readSensor(void *) { Serial.println("read sensor"); }
+void report(void *) { Serial.println("report"); }
+
+void setup() {
+  Serial.begin(115200);
+
+  // every 2 sec (+ 0.5 sec slack) and every 60 sec (+ 5 sec slack)
+  scheduler.addJob(readSensor, 2000000, 500000);
+  scheduler.addJob(report, 60000000, 5000000);
+  LowPower.setScheduler(scheduler);
+}
+
+void loop() {
+  LowPower.process();
+}
@@ -0,0 +1,46 @@
+/**
+ * @brief Example which uses the wakeup cause to skip the full initialization
+ * after a timer wakeup: only a pin wakeup (or a power on) needs the full
+ * setup.
+ * @author Phil Schatzmann
+ */
+#include "LowPower.h"
+
+const int button_pin = 4;
+
+void fullSetup() { Serial.println("full setup"); }
+
+void report() {
+  wakeup_info_t info = LowPower.wakeupInfo();
+  switch (info.cause) {
+    case wakeup_cause_t::timer:
+      Serial.println("timer wakeup");
+      break;
+    case wakeup_cause_t::pin:
+      Serial.print("pin wakeup: ");
+      Serial.println(info.pin);
+      fullSetup();
+      break;
+    default:
+      Serial.println("no wakeup");
+      fullSetup();
+      break;
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  // after a deep sleep restart we continue here
+  report();
+
+  // setup low power definition
+  LowPower.setSleepMode(sleep_mode_enum_t::deepSleep);
+  LowPower.setSleepTime(10, time_unit_t::sec);
+  LowPower.addWakeupPin(button_pin, pin_change_t::on_high);
+}
+
+void loop() {
+  LowPower.sleep();
+  // we only get here if the sleep mode does not restart the processor
+  report();
+}
@@ -0,0 +1,36 @@
+/**
+ * @brief ESP8266: Deep sleep with a fast WiFi resume. The WiFi state is saved
+ * to the RTC user memory before each deep sleep, so that we can reconnect
+ * after the wakeup without scan, association and DHCP.
+ *
+ * @author Phil Schatzmann
+ */
+
+#include "LowPower.h"
+
+const char* ssid = "SSID";
+const char* password = "PWD";
+
+void setup() {
+  Serial.begin(115200);
+  // go back to sleep if this was only an intermediate wakeup
+  LowPower.resumeChainedSleep();
+
+  // login to Wifi: use the saved state if possible
+  bool ok = LowPower.resumeWifi(ssid, password);
+  Serial.print(ok ? "connected" : "not connected");
+  Serial.print(LowPower.isWifiResumed() ? " (resumed) in " : " in ");
+  Serial.print(LowPower.wifiReconnectMs());
+  Serial.println(" ms");
+
+  // setup low power definition
+  LowPower.setWifiResume(true);
+  LowPower.setSleepMode(sleep_mode_enum_t::deepSleep);
+  LowPower.setSleepTime(60, time_unit_t::sec);
+  LowPower.setActiveTime(2, time_unit_t::sec);
+}
+
+void loop() {
+  // report the data
+  LowPower.process();
+}
@@ -2,7 +2,9 @@
 
 #include "LowPowerConfig.h"
 
-#if defined(ESP32)
+#if defined(LOW_POWER_HOST)
+#  include "LowPowerHost.h"
+#elif defined(ESP32)
 #  include "LowPowerESP32.h"
 #elif defined(ESP8266)
 #  include "LowPowerESP8266.h"
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <avr/power.h>  // Power management
 #include <avr/sleep.h>  // Sleep Modes
@@ -10,6 +11,13 @@
 //#include <SoftwareSerial.h>
 //SoftwareSerial Serial(2, 3);  // RX and TX
 
+/// the watchdog control register has different names
+#if defined(WDTCSR)
+#  define LP_WDT_REG WDTCSR
+#else
+#  define LP_WDT_REG WDTCR
+#endif
+
 namespace low_power {
 
 class ArduinoLowPowerATTiny;
@@ -18,13 +26,16 @@ ArduinoLowPowerATTiny *selfArduinoLowPowerATTiny = nullptr;
 /**
  * @brief Low Power Management for ATTiny:
  * - deep sleep: can be woken up by pins or time based. Internally
- * we use the watchdog.
+ * we use the watchdog interrupt: a sleep time is split into the smallest
+ * sequence of the 10 watchdog periods (16 ms - 8 s) and the prescaler is
+ * reprogrammed between the cycles. The period of the watchdog oscillator is
+ * calibrated against millis() and stored in the EEPROM.
  *
  * @author Phil Schatzmann
  * see https://www.re-innovation.co.uk/docs/sleep-modes-on-attiny85/
  */
 
-class ArduinoLowPowerATTiny : public ArduinoLowPowerCommon {
+class ArduinoLowPowerATTiny : public LP_COMMON(ArduinoLowPowerATTiny) {
  public:
   ArduinoLowPowerATTiny() { selfArduinoLowPowerATTiny = this; }
 
@@ -32,16 +43,47 @@ class ArduinoLowPowerATTiny : public ArduinoLowPowerCommon {
   bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) { return false; }
 
   /// sets processor into sleep mode
-  bool sleep(void) override {
-    if (sleep_mode == sleep_mode_enum_t::deepSleep) {
-      open_watchdog_cycle = 0;
+  bool sleep(void) LP_OVERRIDE {
+    bool is_deep_sleep = sleep_mode == sleep_mode_enum_t::deepSleep;
+    // the compiler removes the code if the mode is disabled: we check this
+    // before the peripherals are suspended
+    if (is_deep_sleep ? !isModeEnabled(sleep_mode_enum_t::deepSleep)
+                      : !isModeEnabled(sleep_mode_enum_t::lightSleep) &&
+                            !isModeEnabled(sleep_mode_enum_t::modemSleep) &&
+                            !isModeEnabled(sleep_mode_enum_t::noSleep))
+      return false;
+    beginSleep();
+    if (is_deep_sleep) {
+      if (sleep_time_us > 0 && watchdog_base_us == 0) loadWatchdogCalibration();
+      is_pin_wakeup = false;
       set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-      if (sleep_time_us > 0) setupWatchdog();
-      doDeepSleep();
-      // for the case where we need to sleep for multiple cycles
-      while (open_watchdog_cycle > 0) {
+      enterSleep();
+      time_us_t slept_us = 0;
+      if (sleep_time_us > 0) {
+        // sleep for the planned sequence of watchdog cycles
+        time_us_t remaining_us = sleep_time_us;
+        while (!is_pin_wakeup) {
+          int idx = watchdogIdx(remaining_us);
+          if (idx < 0) break;
+          setupWatchdog(idx);
+          doDeepSleep();
+          time_us_t period_us = watchdogPeriodUs(idx);
+          slept_us += period_us;
+          remaining_us -= period_us < remaining_us ? period_us : remaining_us;
+        }
+      } else {
         doDeepSleep();
       }
+      // timer0 is stopped in power down: we report the planned time. The
+      // watchdog counter can not be read, so the period which is ended by a
+      // pin interrupt is counted completely: the time is overcounted by up
+      // to this period (max 8 s).
+      if (is_pin_wakeup)
+        exitSleep(wakeup_cause_t::pin, slept_us, wakeup_pin);
+      else
+        exitSleep(sleep_time_us > 0 ? wakeup_cause_t::timer
+                                    : wakeup_cause_t::undefined,
+                  slept_us);
       wdt_disable();
       set_sleep_mode(SLEEP_MODE_IDLE);
     } else {
@@ -49,82 +91,181 @@ class ArduinoLowPowerATTiny : public ArduinoLowPowerCommon {
       set_sleep_mode(SLEEP_MODE_IDLE);
       power_all_disable();
       power_timer0_enable();
-      delay(sleep_time_us / 1000);
+      enterSleep();
+      delayUs(sleep_time_us);
+      exitSleep(wakeup_cause_t::timer);
       power_all_enable();
     }
+    endSleep();
     return true;
   }
 
-  bool setSleepTime(uint32_t time, time_unit_t time_unit_type) override {
-    sleep_time_us = toUs(time, time_unit);
+  bool setSleepTime(uint64_t time, time_unit_t time_unit_type) LP_OVERRIDE {
+    sleep_time_us = toUs(time, time_unit_type);
     return true;
   }
 
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
     // ADCSRA = 0;  // ADC disabled
     attachInterrupt(pin, pinWakupCB,
                     change_type == pin_change_t::on_high
                         ? RISING
                         : FALLING);  // interrupt on falling edge of pin2
+    wakeup_pin = pin;
     return true;
   }
 
-  bool isModeSupported(sleep_mode_enum_t sleep_mode) override { return true; }
+  /// power down needs the oscillator startup time after the wakeup
+  sleep_mode_cost_t getSleepModeCost(sleep_mode_enum_t mode) LP_OVERRIDE {
+    switch (mode) {
+      case sleep_mode_enum_t::deepSleep:
+        return {10, 65000, false, 15, 0};
+      case sleep_mode_enum_t::noSleep:
+        return {0, 0, false, 15000, 0};
+      default:
+        return {0, 10, false, 3300, 0};
+    }
+  }
+
+  bool isModeSupported(sleep_mode_enum_t sleep_mode) LP_OVERRIDE { return true; }
+
+  /// Number of watchdog wakeups which are planned for the sleep time
+  uint32_t getPlannedWakeups() {
+    uint32_t result = 0;
+    time_us_t remaining_us = sleep_time_us;
+    int idx;
+    while ((idx = watchdogIdx(remaining_us)) >= 0) {
+      time_us_t period_us = watchdogPeriodUs(idx);
+      remaining_us -= period_us < remaining_us ? period_us : remaining_us;
+      result++;
+    }
+    return result;
+  }
+
+  /// Measures the watchdog period against micros(): the oscillator drifts
+  /// with the voltage and temperature. This takes about 1 second. Returns
+  /// the calibrated period of the shortest watchdog interval in us.
+  uint16_t calibrateWatchdog(bool save = true) {
+    const int idx = 4;  // 256 ms
+    const uint16_t cycles = 4;
+    watchdog_cycles = 0;
+    setupWatchdog(idx);
+    // synchronize with the first interrupt
+    while (watchdogCycles() == 0);
+    uint32_t start_us = micros();
+    while (watchdogCycles() < cycles + 1);
+    uint32_t period_us = (micros() - start_us) / cycles;
+    wdt_disable();
+    uint16_t base_us = period_us >> idx;
+    if (!isValidCalibration(base_us)) return watchdog_base_us;
+    watchdog_base_us = base_us;
+    if (save) {
+      uint16_t data[2] = {base_us, (uint16_t)~base_us};
+      eeprom_update_block(data, (void *)LOW_POWER_EEPROM_ADDRESS,
+                          sizeof(data));
+    }
+    return base_us;
+  }
+
+  /// Loads the calibration from the EEPROM: if there is no valid value we
+  /// calibrate the watchdog
+  uint16_t loadWatchdogCalibration() {
+    uint16_t data[2];
+    eeprom_read_block(data, (const void *)LOW_POWER_EEPROM_ADDRESS,
+                      sizeof(data));
+    if (data[1] == (uint16_t)~data[0] && isValidCalibration(data[0])) {
+      watchdog_base_us = data[0];
+      return watchdog_base_us;
+    }
+    return calibrateWatchdog();
+  }
 
   void clear() {
     LP_LOG("clear");
     ArduinoLowPowerCommon::clear();
-    sleep_time_us = 0;
-    open_watchdog_cycle = 0;
     pin_mask = 0;
+    wakeup_pin = -1;
     set_sleep_mode(SLEEP_MODE_IDLE);
   }
 
   /// Called by watchdog interrupt
   static void processWatchdogCycle() {
-    if (selfArduinoLowPowerATTiny != nullptr &&
-        selfArduinoLowPowerATTiny->open_watchdog_cycle > 0) {
-      selfArduinoLowPowerATTiny->open_watchdog_cycle--;
-    }
+    if (selfArduinoLowPowerATTiny != nullptr)
+      selfArduinoLowPowerATTiny->watchdog_cycles++;
   }
 
  protected:
-  int open_watchdog_cycle = 0;
-  uint32_t sleep_time_us = 0;
   uint32_t pin_mask = 0;
-  uint16_t timings_ms[8] = {15, 30, 60, 120, 250, 500, 1000, 2000};
+  volatile bool is_pin_wakeup = false;
+  volatile uint16_t watchdog_cycles = 0;
+  int8_t wakeup_pin = -1;
+  /// calibrated period of the shortest watchdog interval (0 = not loaded)
+  uint16_t watchdog_base_us = 0;
+  /// number of watchdog prescalers: 16 ms << idx
+  static const int watchdog_idx_count = 10;
+
+  /// watchdog period: 2048 cycles of the 128 kHz oscillator << idx
+  time_us_t watchdogPeriodUs(int idx) {
+    uint32_t base_us = watchdog_base_us > 0 ? watchdog_base_us : 16000;
+    return base_us << idx;
+  }
 
+  /// the oscillator is specified with +-10%: we accept +-25%
+  static bool isValidCalibration(uint16_t base_us) {
+    return base_us >= 12000 && base_us <= 20000;
+  }
 
-  void setupWatchdog() {
-    int sleep_time_ms = sleep_time_us / 1000;
-    int idx = getTimeIdx(sleep_time_ms);
-    open_watchdog_cycle = sleep_time_ms / timings_ms[idx];
-    wdt_enable(idx);  // Set WDog
+  /// reads the 16 bit counter which is updated by the watchdog interrupt
+  uint16_t watchdogCycles() {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t result = watchdog_cycles;
+    SREG = sreg;
+    return result;
   }
 
-  // get the closest smaller time
-  int getTimeIdx(int ms) {
-    for (int j = 0; j < 5; j++) {
-      if (timings_ms[j + 1] > ms) return j;
+  /// selects the longest watchdog period which fits into the remaining
+  /// time: remainders below half of the shortest period are dropped. Returns
+  /// -1 if we are done.
+  int watchdogIdx(time_us_t remaining_us) {
+    if (remaining_us < watchdogPeriodUs(0) / 2) return -1;
+    for (int idx = watchdog_idx_count - 1; idx > 0; idx--) {
+      if (watchdogPeriodUs(idx) <= remaining_us) return idx;
     }
-    // 1sec
-    return 6;
+    return 0;
   }
 
-  static void pinWakupCB() {}
+  /// starts the watchdog in interrupt mode (without reset)
+  void setupWatchdog(int idx) {
+    uint8_t prescaler = (idx & 7) | ((idx & 8) ? _BV(WDP3) : 0);
+    uint8_t sreg = SREG;
+    cli();
+    wdt_reset();
+    MCUSR &= ~_BV(WDRF);
+    // timed sequence: change enable and then the new value within 4 cycles
+    LP_WDT_REG = _BV(WDCE) | _BV(WDE);
+    LP_WDT_REG = _BV(WDIE) | prescaler;
+    SREG = sreg;
+  }
+
+  /// a pin wakeup stops the chain of watchdog cycles
+  static void pinWakupCB() {
+    ArduinoLowPowerATTiny *self = selfArduinoLowPowerATTiny;
+    if (self == nullptr) return;
+    self->is_pin_wakeup = true;
+    self->wake_events.push(wakeup_cause_t::pin, self->wakeup_pin,
+                           digitalRead(self->wakeup_pin));
+  }
 
-  // set processor into deep sleep
+  // set processor into deep sleep until the next interrupt
   void doDeepSleep() {
     cli();
     sleep_enable();
     sleep_bod_disable();
     sei();
     sleep_cpu();
-    if (open_watchdog_cycle <= 0) {
-      // after waking up
-      sleep_disable();
-    }
-    sei();
+    // after waking up
+    sleep_disable();
   }
 };
 
@@ -135,7 +276,6 @@ static ArduinoLowPowerATTiny LowPower;
 
 // watchdog interrupt
 ISR(WDT_vect) {
-  wdt_reset();
   if (low_power::selfArduinoLowPowerATTiny != nullptr)
     low_power::selfArduinoLowPowerATTiny->processWatchdogCycle();
 
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+#if defined(ESP32)
+#  include "esp_idf_version.h"
+#  include "esp_system.h"
+#  if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#    include "esp_rtc_time.h"
+#  elif defined(CONFIG_IDF_TARGET_ESP32S2)
+#    include "esp32s2/rtc.h"
+#  elif defined(CONFIG_IDF_TARGET_ESP32S3)
+#    include "esp32s3/rtc.h"
+#  elif defined(CONFIG_IDF_TARGET_ESP32C3)
+#    include "esp32c3/rtc.h"
+#  else
+#    include "esp32/rtc.h"
+#  endif
+#elif defined(ESP8266)
+#  include <coredecls.h>  // crc32()
+#endif
+
+namespace low_power {
+
+#if defined(ESP32) || defined(ESP8266)
+/// Time of the library clock which is kept in the RTC memory during a deep
+/// sleep which restarts the processor
+struct clock_state_t {
+  uint32_t magic;
+  /// library time when we entered the deep sleep
+  time_us_t saved_us;
+  /// expected sleep time
+  time_us_t sleep_us;
+  /// ESP32: time of the RTC counter
+  time_us_t rtc_us;
+};
+#endif
+
+#if defined(ESP32)
+/// the RTC slow memory is not initialized by a deep sleep restart
+RTC_DATA_ATTR static clock_state_t lp_clock_state;
+#endif
+
+/**
+ * @brief Monotonic 64 bit time in microseconds: we use the 64 bit time of
+ * the platform if available, otherwise the 32 bit millis() are extended to
+ * 64 bits. For this nowUs() must be called at least once every 49 days.
+ *
+ * The time keeps counting across the sleep: if the platform clock stops
+ * (e.g. ATTiny power down, SAMD standby) the backend adds the slept time.
+ * If the deep sleep restarts the processor the time is saved before the
+ * sleep and restored after the restart: on the ESP32 we add the time which
+ * passed on the RTC counter, on the ESP8266 the planned sleep time.
+ * @author Phil Schatzmann
+ */
+class LowPowerClock {
+ public:
+  /// Provides the time in microseconds
+  time_us_t nowUs() {
+#if defined(ESP32) || defined(ESP8266)
+    if (!is_restored) restore();
+#endif
+    return platformUs() + offset_us;
+  }
+
+  /// Provides the time in milliseconds
+  time_us_t nowMs() { return nowUs() / 1000; }
+
+  /// Adds the time while the platform clock was stopped
+  void addSleptUs(time_us_t us) { offset_us += us; }
+
+  /// Call before a deep sleep which restarts the processor: we save the
+  /// time, so that we can continue after the restart
+  void saveBeforeRestart(time_us_t sleep_us) {
+#if defined(ESP32)
+    lp_clock_state = {magic, nowUs(), sleep_us, esp_rtc_get_time_us()};
+#elif defined(ESP8266)
+    clock_state_t state = {magic, nowUs(), sleep_us, 0};
+    state.magic = crc32(&state.saved_us, sizeof(time_us_t) * 2);
+    ESP.rtcUserMemoryWrite(LOW_POWER_RTC_CLOCK_OFFSET, (uint32_t *)&state,
+                           sizeof(state));
+#endif
+  }
+
+ protected:
+  uint32_t last_ms = 0;
+  uint32_t ms_high = 0;
+  time_us_t offset_us = 0;
+  bool is_restored = false;
+  static const uint32_t magic = 0x4C50434B;
+
+  time_us_t platformUs() {
+#if defined(LOW_POWER_HOST)
+    return hostSimulation().nowUs();
+#elif defined(ARDUINO_ARCH_RP2040)
+    return time_us_64();
+#elif defined(ESP32)
+    return esp_timer_get_time();
+#elif defined(ESP8266)
+    return micros64();
+#else
+    uint32_t ms = millis();
+    if (ms < last_ms) ms_high++;
+    last_ms = ms;
+    return ((((time_us_t)ms_high) << 32) | ms) * 1000;
+#endif
+  }
+
+#if defined(ESP32)
+  /// continue with the saved time after a deep sleep restart
+  void restore() {
+    is_restored = true;
+    if (lp_clock_state.magic != magic) return;
+    lp_clock_state.magic = 0;
+    if (esp_reset_reason() != ESP_RST_DEEPSLEEP) return;
+    // the RTC counter keeps running in deep sleep and is not changed when
+    // the system time is set: the boot time is already part of
+    // esp_timer_get_time()
+    time_us_t rtc_us = esp_rtc_get_time_us();
+    time_us_t elapsed_us = rtc_us > lp_clock_state.rtc_us
+                               ? rtc_us - lp_clock_state.rtc_us
+                               : lp_clock_state.sleep_us + platformUs();
+    time_us_t now_us = platformUs();
+    if (elapsed_us < now_us) elapsed_us = now_us;
+    offset_us = lp_clock_state.saved_us + elapsed_us - now_us;
+  }
+#elif defined(ESP8266)
+  /// continue with the saved time and the planned sleep after a deep sleep
+  /// restart: micros64() contains the boot time
+  void restore() {
+    is_restored = true;
+    clock_state_t state;
+    if (!ESP.rtcUserMemoryRead(LOW_POWER_RTC_CLOCK_OFFSET, (uint32_t *)&state,
+                               sizeof(state)))
+      return;
+    if (state.magic != crc32(&state.saved_us, sizeof(time_us_t) * 2)) return;
+    state.magic = 0;
+    ESP.rtcUserMemoryWrite(LOW_POWER_RTC_CLOCK_OFFSET, (uint32_t *)&state,
+                           sizeof(uint32_t));
+    if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE) return;
+    offset_us = state.saved_us + state.sleep_us;
+  }
+#endif
+};
+
+}  // namespace low_power
@@ -1,28 +1,51 @@
 #pragma once
 
-#include <Arduino.h>
+#include "LowPowerConfig.h"
 
-#include "LowPowerCommon.h"
+#if defined(LOW_POWER_HOST)
+#  include "drivers/host/host_arduino.h"
+#else
+#  include <Arduino.h>
+#endif
 
-namespace low_power {
-
-enum class sleep_mode_enum_t {
-  noSleep,
-  lightSleep,
-  deepSleep,
-  modemSleep,
-};
+#include "LowPowerClock.h"
+#include "LowPowerCron.h"
+#include "LowPowerEvents.h"
+#include "LowPowerLog.h"
+#if LOW_POWER_GOVERNOR
+#  include "LowPowerGovernor.h"
+#endif
+#if LOW_POWER_PERIPHERALS
+#  include "LowPowerPeripherals.h"
+#endif
+#include "LowPowerRetained.h"
+#include "LowPowerScheduler.h"
+#include "LowPowerStatistics.h"
+#include "LowPowerTime.h"
+#include "LowPowerTypes.h"
+#include "LowPowerULP.h"
 
-enum class time_unit_t {
-  sec,
-  ms,
-  us,
-};
+/**
+ * With LOW_POWER_STATIC_DISPATCH the common class is a CRTP template: the
+ * backend is resolved at compile time and we do not need any vtables. The
+ * backends are declared with LP_COMMON(BackendClass) as base class and use
+ * LP_OVERRIDE instead of override.
+ */
+#if LOW_POWER_STATIC_DISPATCH
+#  define LP_COMMON_TEMPLATE template <class Impl>
+#  define LP_COMMON(impl) ArduinoLowPowerCommon<impl>
+#  define LP_VIRTUAL
+#  define LP_OVERRIDE
+#  define LP_SELF static_cast<Impl *>(this)
+#else
+#  define LP_COMMON_TEMPLATE
+#  define LP_COMMON(impl) ArduinoLowPowerCommon
+#  define LP_VIRTUAL virtual
+#  define LP_OVERRIDE override
+#  define LP_SELF this
+#endif
 
-enum class pin_change_t {
-  on_high,
-  on_low,
-};
+namespace low_power {
 
 /**
  * @brief Common API for power saving modes for different processor
@@ -30,81 +53,203 @@ enum class pin_change_t {
  * @author Phil Schatzmann
  */
 
+LP_COMMON_TEMPLATE
 class ArduinoLowPowerCommon {
  public:
+#if !LOW_POWER_STATIC_DISPATCH
   /// Sets processor into sleep mode
   virtual bool sleep(void) = 0;
 
   /// Defines the sleep time
-  virtual bool setSleepTime(uint32_t time, time_unit_t time_unit_type) = 0;
+  virtual bool setSleepTime(uint64_t time, time_unit_t time_unit_type) = 0;
 
   /// Defines the wakup pin
   virtual bool addWakeupPin(int pin, pin_change_t change_type) = 0;
 
+  /// Returns true if processing is possible in the current sleep mode
+  virtual bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) = 0;
+#endif
+
+  /// Defines an analog pin which wakes up the processor when the value
+  /// meets the window condition: returns false if this is not supported
+  LP_VIRTUAL bool addWakeupAnalog(int pin, analog_window_t window,
+                                  uint16_t low, uint16_t high) {
+    return false;
+  }
+
   /// sets mc into sleep mode to sleep for indicated millis
-  virtual bool sleepFor(uint32_t time, time_unit_t time_unit_type) {
-    setSleepTime(time, time_unit_type);
-    sleep();
+  LP_VIRTUAL bool sleepFor(uint64_t time, time_unit_t time_unit_type) {
+    LP_SELF->setSleepTime(time, time_unit_type);
+    LP_SELF->sleep();
     return true;
   }
 
+  /// Defines the current time in seconds since 1970-01-01 UTC (e.g. from
+  /// NTP or GPS): by default it is continued with the monotonic clock,
+  /// backends with a calendar RTC set the RTC
+  LP_VIRTUAL bool setEpoch(int64_t epoch) {
+    epoch_offset_us = epoch * 1000000 - (int64_t)nowUs();
+    is_epoch = true;
+    return true;
+  }
+
+  /// Provides the microseconds since 1970-01-01 UTC or -1 if the time was
+  /// not defined with setEpoch()
+  LP_VIRTUAL int64_t getEpochUs() {
+    return is_epoch ? epoch_offset_us + (int64_t)nowUs() : -1;
+  }
+
+  /// Provides the seconds since 1970-01-01 UTC or -1 if the time is not
+  /// defined
+  int64_t getEpoch() {
+    int64_t epoch_us = LP_SELF->getEpochUs();
+    return epoch_us < 0 ? -1 : epoch_us / 1000000;
+  }
+
+  /// Sleeps with the current sleep mode until the indicated time (seconds
+  /// since 1970-01-01 UTC): by default the remaining time is determined
+  /// from getEpochUs(), so that we do not drift. Returns false if the time
+  /// is not defined.
+  LP_VIRTUAL bool sleepUntil(int64_t epoch) {
+    int64_t now_us = LP_SELF->getEpochUs();
+    if (now_us < 0) return false;
+    int64_t wait_us = epoch * 1000000 - now_us;
+    if (wait_us <= 0) return true;
+    return LP_SELF->sleepFor(wait_us, time_unit_t::us);
+  }
+
+  /// Sleeps until the next fire time of the schedule: returns false if the
+  /// time is not defined or if the schedule never fires
+  bool sleepUntilNext(CronSchedule &schedule) {
+    int64_t now = getEpoch();
+    if (now < 0) return false;
+    int64_t next = schedule.next(now);
+    if (next < 0) return false;
+    return LP_SELF->sleepUntil(next);
+  }
+
   /// sets the flag to be active
-  virtual void setActive(bool flag) { is_active = false; }
+  LP_VIRTUAL void setActive(bool flag) { is_active = false; }
 
   /// Defiles the active time
-  virtual void setActiveTime(uint32_t time, time_unit_t time_unit_type) {
+  LP_VIRTUAL void setActiveTime(uint64_t time, time_unit_t time_unit_type) {
     timeout_us = toUs(time, time_unit_type);
-    char msg[80];
-    sprintf(msg, "timeout %u ms", timeout_us);
-    LP_LOG(msg);
-    timeout_end_ms = millis() + (timeout_us / 1000);
+    LP_LOGI("timeout ms", (int32_t)(timeout_us / 1000));
+    timeout_end_us = timeout_us > 0 ? nowUs() + timeout_us : 0;
   }
 
   /// Checks if we are active (not sleeping)
-  virtual bool isActive() {
-    if (timeout_end_ms > 0 && millis() > timeout_end_ms) {
-      Serial.println("timed out");
+  LP_VIRTUAL bool isActive() {
+    if (timeout_end_us > 0 && nowUs() > timeout_end_us) {
+      LP_LOGD("timed out");
       return false;
     }
     if (!is_active) {
-      Serial.println("set to inactive");
+      LP_LOGD("set to inactive");
       return false;
     } 
     return true;
   }
 
   /// same as isActive()
-  virtual operator bool() { return isActive(); }
+  LP_VIRTUAL operator bool() { return LP_SELF->isActive(); }
 
   /// Defines the sleep mode
-  virtual bool setSleepMode(sleep_mode_enum_t mode) {
+  LP_VIRTUAL bool setSleepMode(sleep_mode_enum_t mode) {
     sleep_mode = mode;
-    bool result = isModeSupported(mode);
-    if (result && mode == sleep_mode_enum_t::modemSleep) sleep();
+    bool result = isModeEnabled(mode) && LP_SELF->isModeSupported(mode);
+    if (result && mode == sleep_mode_enum_t::modemSleep) LP_SELF->sleep();
     return result;
   }
 
   /// @brief Triggers the processing to be active or sleeping based on the set
   /// definitions
-  virtual void process() {
-    // check if we need to be active
-    if (isActive()) return;
+  LP_VIRTUAL void process() {
+    // the scheduler defines when we sleep
+    if (p_scheduler != nullptr && p_scheduler->jobCount() > 0) {
+      processScheduler();
+      return;
+    }
+    // check if we need to be active: we output the log only while we are
+    // not in the sleep / wakeup path
+    if (LP_SELF->isActive()) {
+      flushLog();
+      return;
+    }
     // sleep processor
-    sleep();
+#if LOW_POWER_GOVERNOR
+    if (p_governor != nullptr)
+      sleepGoverned(sleep_time_us);
+    else
+#endif
+      LP_SELF->sleep();
     // after wakeup: recalculate next timeout
-    setActiveTime(timeout_us, time_unit_t::us);
+    LP_SELF->setActiveTime(timeout_us, time_unit_t::us);
   }
 
-  /// Returns true if processing is possible in the current sleep mode
-  virtual bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) = 0;
+  /// Activates the scheduler: process() executes the due jobs and then sleeps
+  /// in the deepest mode which still meets the next deadline. The scheduler
+  /// defines the sleep time and mode for each sleep.
+  void setScheduler(LowPowerScheduler &scheduler) { p_scheduler = &scheduler; }
+
+#if LOW_POWER_GOVERNOR
+  /// Activates the governor: process() selects the sleep mode with the
+  /// lowest expected energy for the predicted idle time
+  void setGovernor(LowPowerGovernor &governor) { p_governor = &governor; }
+#endif
+
+  /// Provides the entry/exit costs and the power of the indicated sleep mode
+  LP_VIRTUAL sleep_mode_cost_t getSleepModeCost(sleep_mode_enum_t mode) {
+    switch (mode) {
+      case sleep_mode_enum_t::lightSleep:
+        return {100, 1000, false, 1000, 0};
+      case sleep_mode_enum_t::deepSleep:
+        return {1000, 100000, true, 10, 0};
+      case sleep_mode_enum_t::modemSleep:
+        return {0, 0, false, 50000, 0};
+      default:
+        return {0, 0, false, 100000, 0};
+    }
+  }
+
+  /// Determines the deepest sleep mode which returns to the processing
+  /// within the indicated idle time
+  sleep_mode_enum_t selectSleepMode(time_us_t idle_us) {
+    static const sleep_mode_enum_t modes[] = {sleep_mode_enum_t::deepSleep,
+                                              sleep_mode_enum_t::lightSleep};
+    for (sleep_mode_enum_t mode : modes) {
+      if (!isModeEnabled(mode) || !LP_SELF->isModeSupported(mode)) continue;
+      sleep_mode_cost_t cost = LP_SELF->getSleepModeCost(mode);
+      if (cost.is_restart) continue;
+      if ((time_us_t)cost.entry_us + cost.exit_us < idle_us) return mode;
+    }
+    return sleep_mode_enum_t::noSleep;
+  }
+
+  /// Provides the cause, pin and time of the last wakeup: after a restart
+  /// from deep sleep the information is determined from the hardware
+  LP_VIRTUAL wakeup_info_t wakeupInfo() { return wakeup_info; }
+
+  /// Provides the source of the last wakeup (e.g. to skip the full
+  /// initialization after a timer wakeup)
+  wakeup_cause_t wakeupCause() { return LP_SELF->wakeupInfo().cause; }
+
+  /// Provides the monotonic 64 bit time in microseconds: it keeps counting
+  /// across all sleep modes (also if the deep sleep restarts the processor)
+  time_us_t nowUs() { return monotonic_clock.nowUs(); }
 
   /// Returns true if processing is possible in the current sleep mode
-  virtual bool isProcessingOnSleep() {
-    return isProcessingOnSleep(sleep_mode);
+  LP_VIRTUAL bool isProcessingOnSleep() {
+    return LP_SELF->isProcessingOnSleep(sleep_mode);
   };
 
+  /// Returns false if the mode was removed by LOW_POWER_SLEEP_MODES
+  static constexpr bool isModeEnabled(sleep_mode_enum_t mode) {
+    return (LOW_POWER_SLEEP_MODES & (1 << (int)mode)) != 0;
+  }
+
   /// Provides information if the indicated mode is supported 
-  virtual bool isModeSupported(sleep_mode_enum_t sleep_mode) {
+  LP_VIRTUAL bool isModeSupported(sleep_mode_enum_t sleep_mode) {
     bool result = true;
     switch (sleep_mode) {
       case sleep_mode_enum_t::noSleep:
@@ -123,34 +268,220 @@ class ArduinoLowPowerCommon {
     return result;
   }
 
+  /// Prints the buffered log records to Serial: call it when the time
+  /// critical processing is done (process() calls it while we are active)
+  void flushLog() {
+#if LOW_POWER_LOG_LEVEL > 0
+    lp_log.flush(Serial);
+#endif
+  }
+
+  /// Provides the wakeup events which were recorded by the interrupts: drain
+  /// them with pop() after sleep() returned
+  WakeEventQueue &wakeEvents() { return wake_events; }
+
+#if LOW_POWER_PERIPHERALS
+  /// Provides the registry of the peripherals which are suspended during
+  /// the sleep
+  PeripheralRegistry &peripherals() { return peripheral_registry; }
+#endif
+
+#if LOW_POWER_STATISTICS
+  /// Provides the recorded sleep statistics
+  const sleep_statistics_t &statistics() { return stats.get(); }
+
+  /// Provides the statistics recorder
+  LowPowerStatistics &statisticsRecorder() { return stats; }
+
+  /// Resets the sleep statistics
+  void clearStatistics() { stats.clear(); }
+#endif
+
   /// reset the processing
-  virtual void clear() {
+  LP_VIRTUAL void clear() {
     sleep_mode = sleep_mode_enum_t::deepSleep;
     time_unit = time_unit_t::ms;
     timeout_us = 0;
-    timeout_end_ms = 0; 
+    timeout_end_us = 0;
+    sleep_time_us = 0;
+    wakeup_info = {wakeup_cause_t::undefined, -1, 0, false};
     is_active = true;
   }
 
  protected:
   bool is_active = true;
-  uint32_t timeout_end_ms = 0;
-  uint32_t timeout_us = 0;
+  time_us_t timeout_end_us = 0;
+  time_us_t timeout_us = 0;
+  time_us_t sleep_time_us = 0;
+  LowPowerClock monotonic_clock;
+  /// epoch in us at the time 0 of the monotonic clock (see setEpoch())
+  int64_t epoch_offset_us = 0;
+  bool is_epoch = false;
+  LowPowerScheduler *p_scheduler = nullptr;
+#if LOW_POWER_GOVERNOR
+  LowPowerGovernor *p_governor = nullptr;
+#endif
   time_unit_t time_unit = time_unit_t::ms;
   sleep_mode_enum_t sleep_mode = sleep_mode_enum_t::deepSleep;
+  wakeup_info_t wakeup_info = {wakeup_cause_t::undefined, -1, 0, false};
+  WakeEventQueue wake_events;
+#if LOW_POWER_PERIPHERALS
+  PeripheralRegistry peripheral_registry;
+#endif
+#if LOW_POWER_STATISTICS
+  LowPowerStatistics stats;
+#endif
+
+  /// Call at the start of sleep(): suspends the peripherals
+  void beginSleep() {
+#if LOW_POWER_STATISTICS
+    stats.begin(nowUs());
+#endif
+#if LOW_POWER_PERIPHERALS
+    peripheral_registry.suspend(sleep_mode);
+#endif
+  }
+
+  /// Call just before the processor enters the hardware sleep
+  void enterSleep() {
+#if LOW_POWER_STATISTICS
+    stats.enter(sleep_mode, nowUs());
+#endif
+  }
+
+  /// Call just after the processor woke up: provide the slept time if the
+  /// clock is not running during the sleep and the pin which woke us up:
+  /// the slept time is added to the monotonic clock
+  void exitSleep(wakeup_cause_t cause, time_us_t slept_us = 0, int pin = -1) {
+    monotonic_clock.addSleptUs(slept_us);
+    wakeup_info = {cause, pin, nowUs(), false};
+#if LOW_POWER_STATISTICS
+    stats.exit(cause, nowUs(), slept_us);
+#endif
+  }
 
-  uint32_t toUs(uint32_t time, time_unit_t time_unit) {
+  /// Call before sleep() returns: resumes the peripherals
+  void endSleep() {
+#if LOW_POWER_PERIPHERALS
+    peripheral_registry.resume();
+#endif
+#if LOW_POWER_STATISTICS
+    stats.end(nowUs());
+#endif
+  }
+
+  time_us_t toUs(uint64_t time, time_unit_t time_unit) {
     switch (time_unit) {
       case time_unit_t::sec:
-        return time * 1000000;
+        return time * 1000000ull;
       case time_unit_t::ms:
-        return time * 1000;
+        return time * 1000ull;
       case time_unit_t::us:
         return time;
     }
-    Serial.println("undefined error");
+    LP_LOGE("undefined time unit");
     return 0;
   }
+
+  /// Executes the due jobs and sleeps until the next deadline
+  void processScheduler() {
+    p_scheduler->run(nowUs());
+    time_us_t wakeup_us = p_scheduler->nextWakeupUs();
+    time_us_t now_us = nowUs();
+    if (wakeup_us <= now_us) return;
+    time_us_t idle_us = wakeup_us - now_us;
+#if LOW_POWER_GOVERNOR
+    if (p_governor != nullptr) {
+      sleepGoverned(idle_us);
+      return;
+    }
+#endif
+    sleep_mode_enum_t mode = selectSleepMode(idle_us);
+    time_us_t exit_us = LP_SELF->getSleepModeCost(mode).exit_us;
+    if (mode == sleep_mode_enum_t::noSleep) {
+      delayUs(idle_us);
+      return;
+    }
+    sleep_mode_enum_t old_mode = sleep_mode;
+    time_us_t old_sleep_time_us = sleep_time_us;
+    LP_SELF->setSleepTime(idle_us - exit_us, time_unit_t::us);
+    LP_SELF->setSleepMode(mode);
+    // fallback if the mode does not support a timer wakeup
+    if (!LP_SELF->sleep()) delayUs(idle_us);
+    sleep_mode = old_mode;
+    sleep_time_us = old_sleep_time_us;
+  }
+
+#if LOW_POWER_GOVERNOR
+  /// Collects the costs and the availability of all sleep modes for the
+  /// governor: modes which restart the processor are not eligible
+  void sleepModeCosts(sleep_mode_cost_t costs[sleep_mode_count],
+                      bool supported[sleep_mode_count]) {
+    for (int j = 0; j < sleep_mode_count; j++) {
+      sleep_mode_enum_t mode = (sleep_mode_enum_t)j;
+      costs[j] = LP_SELF->getSleepModeCost(mode);
+      supported[j] = mode == sleep_mode_enum_t::noSleep ||
+                     (isModeEnabled(mode) && LP_SELF->isModeSupported(mode) &&
+                      !costs[j].is_restart);
+    }
+  }
+
+  /// Sleeps in the mode selected by the governor: next_timer_us is the next
+  /// known deadline (0 if we only wake up by a pin). After the wakeup we
+  /// report the actual idle time back to the governor.
+  void sleepGoverned(time_us_t next_timer_us) {
+    sleep_mode_cost_t costs[sleep_mode_count];
+    bool supported[sleep_mode_count];
+    sleepModeCosts(costs, supported);
+    time_us_t predicted_us = p_governor->predictIdleUs(next_timer_us);
+    sleep_mode_enum_t mode = p_governor->select(costs, supported, predicted_us);
+    time_us_t start_us = nowUs();
+    if (mode == sleep_mode_enum_t::noSleep) {
+      // without a timer we can only stay active
+      if (next_timer_us == 0) return;
+      delayUs(next_timer_us);
+    } else {
+      sleep_mode_enum_t old_mode = sleep_mode;
+      time_us_t old_sleep_time_us = sleep_time_us;
+      time_us_t exit_us = costs[(int)mode].exit_us;
+      if (next_timer_us > 0)
+        LP_SELF->setSleepTime(
+            next_timer_us > exit_us ? next_timer_us - exit_us : next_timer_us,
+            time_unit_t::us);
+      LP_SELF->setSleepMode(mode);
+      // fallback if the mode does not support the wakeup source
+      if (!LP_SELF->sleep() && next_timer_us > 0) delayUs(next_timer_us);
+      sleep_mode = old_mode;
+      sleep_time_us = old_sleep_time_us;
+    }
+    time_us_t actual_us = nowUs() - start_us;
+    p_governor->addIdleTime(actual_us, mode,
+                            p_governor->select(costs, supported, actual_us));
+  }
+#endif
+
+  /// Splits a long sleep into chunks of at most max_us and calls
+  /// sleep_chunk(us) for each of them. The chain stops early when
+  /// sleep_chunk returns false (e.g. because we were woken up by a pin).
+  template <typename F>
+  bool sleepChained(time_us_t total_us, time_us_t max_us, F sleep_chunk) {
+    while (total_us > 0) {
+      time_us_t chunk_us = total_us > max_us ? max_us : total_us;
+      total_us -= chunk_us;
+      if (!sleep_chunk(chunk_us)) return false;
+    }
+    return true;
+  }
+
+  /// delay() which supports 64 bit microseconds: the remainder below 1 ms
+  /// is waited with delayMicroseconds()
+  void delayUs(time_us_t us) {
+    sleepChained(us, 0xFFFFFFFFull * 1000, [](time_us_t chunk_us) {
+      delay((uint32_t)(chunk_us / 1000));
+      delayMicroseconds((uint32_t)(chunk_us % 1000));
+      return true;
+    });
+  }
 };
 
 }  // namespace low_power
\ No newline at end of file
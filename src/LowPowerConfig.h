@@ -5,6 +5,149 @@
 #  define LOW_POWER_USING_NS 1
 #endif
 
+/// Use the host (e.g. Linux) simulation when we are not compiled by Arduino
+#if !defined(ARDUINO) && !defined(LOW_POWER_HOST)
+#  define LOW_POWER_HOST 1
+#endif
+
+/// Record the sleep statistics (residency, wakeup counts, latencies)
+#ifndef LOW_POWER_STATISTICS
+#  if defined(ARDUINO_attiny)
+#    define LOW_POWER_STATISTICS 0
+#  else
+#    define LOW_POWER_STATISTICS 1
+#  endif
+#endif
+
+/// Number of log2 buckets of the latency histograms
+#ifndef LOW_POWER_HISTOGRAM_BUCKETS
+#  define LOW_POWER_HISTOGRAM_BUCKETS 16
+#endif
+
+/// Max number of jobs of the LowPowerScheduler
+#ifndef LOW_POWER_MAX_JOBS
+#  if defined(ARDUINO_attiny)
+#    define LOW_POWER_MAX_JOBS 4
+#  else
+#    define LOW_POWER_MAX_JOBS 12
+#  endif
+#endif
+
+/// Support for the peripheral suspend / resume hooks in sleep()
+#ifndef LOW_POWER_PERIPHERALS
+#  if defined(ARDUINO_attiny)
+#    define LOW_POWER_PERIPHERALS 0
+#  else
+#    define LOW_POWER_PERIPHERALS 1
+#  endif
+#endif
+
+/// Max number of peripherals in the PeripheralRegistry
+#ifndef LOW_POWER_MAX_PERIPHERALS
+#  define LOW_POWER_MAX_PERIPHERALS 8
+#endif
+
+/// SAMD: the library defines RTC_Handler(): set to 0 (as build flag) if
+/// another library (e.g. RTCZero) defines it as well
+#ifndef LOW_POWER_SAMD_RTC_HANDLER
+#  define LOW_POWER_SAMD_RTC_HANDLER 1
+#endif
+
+/// SAMD: the library defines ADC_Handler(): set to 0 (as build flag) if
+/// another library defines it as well
+#ifndef LOW_POWER_SAMD_ADC_HANDLER
+#  define LOW_POWER_SAMD_ADC_HANDLER 1
+#endif
+
+/// Number of wakeup events which are buffered by the WakeEventQueue: must
+/// be a power of 2 (max 128)
+#ifndef LOW_POWER_EVENT_QUEUE_SIZE
+#  if defined(ARDUINO_attiny)
+#    define LOW_POWER_EVENT_QUEUE_SIZE 8
+#  else
+#    define LOW_POWER_EVENT_QUEUE_SIZE 32
+#  endif
+#endif
+
+/// Support for the predictive LowPowerGovernor in process()
+#ifndef LOW_POWER_GOVERNOR
+#  if defined(ARDUINO_attiny)
+#    define LOW_POWER_GOVERNOR 0
+#  else
+#    define LOW_POWER_GOVERNOR 1
+#  endif
+#endif
+
+/// Number of idle times recorded by the LowPowerGovernor
+#ifndef LOW_POWER_GOVERNOR_HISTORY
+#  define LOW_POWER_GOVERNOR_HISTORY 8
+#endif
+
+/// ESP8266: first RTC user memory block (of 4 bytes) used by the library:
+/// the first 32 blocks are reserved for OTA
+#ifndef LOW_POWER_RTC_OFFSET
+#  define LOW_POWER_RTC_OFFSET 32
+#endif
+#define LOW_POWER_RTC_CHAIN_OFFSET LOW_POWER_RTC_OFFSET
+/// ESP8266: the WiFiState is stored after the 16 bytes of the chain state
+#define LOW_POWER_RTC_WIFI_OFFSET (LOW_POWER_RTC_OFFSET + 4)
+/// ESP8266: the clock state (32 bytes) is stored before the RetainedBuffer
+#define LOW_POWER_RTC_CLOCK_OFFSET (LOW_POWER_RTC_OFFSET + 56)
+/// ESP8266: first RTC user memory block of the RetainedBuffer (after the
+/// WiFiState)
+#ifndef LOW_POWER_RTC_BUFFER_OFFSET
+#  define LOW_POWER_RTC_BUFFER_OFFSET (LOW_POWER_RTC_OFFSET + 64)
+#endif
+
+/// ATTiny: EEPROM address of the watchdog calibration (4 bytes): defaults
+/// to the end of the EEPROM
+#ifndef LOW_POWER_EEPROM_ADDRESS
+#  define LOW_POWER_EEPROM_ADDRESS (E2END - 3)
+#endif
+
+/// Max number of instructions of an UlpProgram
+#ifndef LOW_POWER_ULP_MAX_OPS
+#  define LOW_POWER_ULP_MAX_OPS 32
+#endif
+
+/// ESP32: words at the start of the RTC slow memory which are used as data
+/// by the ULP program: the program is loaded after them
+#ifndef LOW_POWER_ULP_DATA_WORDS
+#  define LOW_POWER_ULP_DATA_WORDS 8
+#endif
+
+/// Resolve the backend at compile time (CRTP) instead of using virtual
+/// functions: this saves the vtables on flash constrained targets
+#ifndef LOW_POWER_STATIC_DISPATCH
+#  if defined(ARDUINO_attiny)
+#    define LOW_POWER_STATIC_DISPATCH 1
+#  else
+#    define LOW_POWER_STATIC_DISPATCH 0
+#  endif
+#endif
+
+/// Bitmask of the supported sleep modes (bit n = sleep_mode_enum_t n): the
+/// code of the removed modes is eliminated by the compiler
+#ifndef LOW_POWER_SLEEP_MODES
+#  define LOW_POWER_SLEEP_MODES 0xF
+#endif
+
 /// Activate / deactivate log
-//#define LP_LOG(x) { Serial.println(x); Serial.flush(); }
-#define LP_LOG(x) 
\ No newline at end of file
+#ifndef LOW_POWER_LOG
+#  define LOW_POWER_LOG 0
+#endif
+
+/// Log level: 0 = off, 1 = error, 2 = warning, 3 = info, 4 = debug. The
+/// messages below the level are removed by the preprocessor.
+#ifndef LOW_POWER_LOG_LEVEL
+#  if LOW_POWER_LOG
+#    define LOW_POWER_LOG_LEVEL 4
+#  else
+#    define LOW_POWER_LOG_LEVEL 0
+#  endif
+#endif
+
+/// Number of log records which are buffered until flushLog()
+#ifndef LOW_POWER_LOG_SIZE
+#  define LOW_POWER_LOG_SIZE 16
+#endif 
\ No newline at end of file
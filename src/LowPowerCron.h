@@ -0,0 +1,241 @@
+#pragma once
+
+#include "LowPowerTime.h"
+
+namespace low_power {
+
+/**
+ * @brief Calendar based wakeup schedule with the 5 fields of a cron
+ * expression: "minute hour day month weekday", e.g. "0 6,18 * * 1-5" for
+ * 06:00 and 18:00 on the weekdays. Each field is stored as bitmask, so that
+ * the next matching value of a field is found with a single bit scan. The
+ * days of a month are combined with the weekdays into one 31 bit mask per
+ * month. So next() does not need to iterate over minutes, hours or days.
+ * The last result is cached: the next fire time is only calculated again
+ * after it has passed.
+ *
+ * Use LowPower.sleepUntilNext(schedule) to sleep until the next fire time.
+ * @author Phil Schatzmann
+ */
+class CronSchedule {
+ public:
+  CronSchedule() = default;
+  CronSchedule(const char *spec) { begin(spec); }
+
+  /// Defines the schedule from a cron expression: each field is *, a value,
+  /// a range (1-5), a list (6,18) or a step (*/15, 0-30/10). Weekday 0 and 7
+  /// are sunday. Returns false if the expression is invalid.
+  bool begin(const char *spec) {
+    static const uint8_t min_value[5] = {0, 0, 1, 1, 0};
+    static const uint8_t max_value[5] = {59, 23, 31, 12, 7};
+    uint64_t masks[5];
+    bool is_any[5];
+    const char *pos = spec;
+    for (int j = 0; j < 5; j++) {
+      while (*pos == ' ') pos++;
+      is_any[j] = *pos == '*';
+      if (!parseField(pos, min_value[j], max_value[j], masks[j])) return false;
+    }
+    while (*pos == ' ') pos++;
+    if (*pos != 0) return false;
+    minutes = masks[0];
+    hours = (uint32_t)masks[1];
+    days = (uint32_t)masks[2];
+    months = (uint16_t)masks[3];
+    // 7 is an alias for sunday
+    weekdays = (uint8_t)((masks[4] | masks[4] >> 7) & 0x7F);
+    // cron: if both day fields are restricted, either of them must match
+    is_day_or = !is_any[2] && !is_any[4];
+    reset();
+    return true;
+  }
+
+  /// Defines the minutes (bit 0 - 59)
+  void setMinutes(uint64_t mask) {
+    minutes = mask;
+    reset();
+  }
+
+  /// Defines the hours (bit 0 - 23)
+  void setHours(uint32_t mask) {
+    hours = mask;
+    reset();
+  }
+
+  /// Defines the days of the month (bit 1 - 31): both the days and the
+  /// weekdays must match
+  void setDays(uint32_t mask) {
+    days = mask;
+    is_day_or = false;
+    reset();
+  }
+
+  /// Defines the months (bit 1 - 12)
+  void setMonths(uint16_t mask) {
+    months = mask;
+    reset();
+  }
+
+  /// Defines the weekdays (bit 0 = sunday - bit 6 = saturday)
+  void setWeekdays(uint8_t mask) {
+    weekdays = mask;
+    is_day_or = false;
+    reset();
+  }
+
+  /// Offset of the local time of the schedule to UTC in seconds
+  void setUtcOffset(int32_t offset_s) {
+    utc_offset_s = offset_s;
+    reset();
+  }
+
+  /// Provides the first fire time (seconds since 1970-01-01 UTC) after the
+  /// indicated time or -1 if the schedule never fires
+  int64_t next(int64_t epoch) {
+    if (next_epoch > epoch && from_epoch <= epoch) return next_epoch;
+    from_epoch = epoch;
+    next_epoch = calculate(epoch);
+    return next_epoch;
+  }
+
+ protected:
+  uint64_t minutes = 1;
+  uint32_t hours = 1;
+  uint32_t days = 0xFFFFFFFE;
+  uint16_t months = 0x1FFE;
+  uint8_t weekdays = 0x7F;
+  bool is_day_or = false;
+  int32_t utc_offset_s = 0;
+  int64_t from_epoch = 0;
+  int64_t next_epoch = -1;
+  /// a day which never exists (e.g. 30th of February) is searched for this
+  /// number of years (the gregorian weekdays repeat after 400 years)
+  static const int max_years = 400;
+
+  void reset() {
+    from_epoch = 0;
+    next_epoch = -1;
+  }
+
+  /// lowest bit >= from or 64 if there is none
+  static uint32_t nextBit(uint64_t mask, uint32_t from) {
+    if (from >= 64) return 64;
+    mask &= ~0ull << from;
+    return mask == 0 ? 64 : (uint32_t)__builtin_ctzll(mask);
+  }
+
+  static uint32_t daysInMonth(int32_t year, uint32_t month) {
+    if (month == 2)
+      return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)) ? 29
+                                                                     : 28;
+    return 30 + ((month + (month >> 3)) & 1);
+  }
+
+  /// bit n is set if day n of the month matches the days and weekdays
+  uint32_t dayMask(int32_t year, uint32_t month) {
+    uint32_t valid = (uint32_t)(((1ull << daysInMonth(year, month)) - 1) << 1);
+    uint32_t dotw = weekdayFromDays(daysFromCivil(year, month, 1));
+    // rotate the weekdays, so that bit 0 is the 1st and repeat them
+    uint64_t week = ((weekdays >> dotw) | (weekdays << (7 - dotw))) & 0x7F;
+    uint32_t by_weekday = (uint32_t)((week * 0x10204081ull) << 1) & valid;
+    uint32_t by_day = days & valid;
+    return is_day_or ? (by_day | by_weekday) : (by_day & by_weekday);
+  }
+
+  int64_t calculate(int64_t epoch) {
+    // we start at the next full minute in the local time
+    int64_t local = epoch + utc_offset_s;
+    local = (local >= 0 ? local / 60 : (local - 59) / 60) * 60 + 60;
+    civil_time_t start;
+    epochToCivil(local, start);
+    int32_t year = start.year;
+    uint32_t month = start.month, day = start.day, hour = start.hour,
+             min = start.min;
+    while (year < start.year + max_years) {
+      uint32_t value = nextBit(months, month);
+      if (value > 12) {
+        year++;
+        month = 1;
+        day = 1;
+        hour = min = 0;
+        continue;
+      }
+      if (value != month) {
+        month = value;
+        day = 1;
+        hour = min = 0;
+      }
+      value = nextBit(dayMask(year, month), day);
+      if (value > 31) {
+        month++;
+        day = 1;
+        hour = min = 0;
+        continue;
+      }
+      if (value != day) {
+        day = value;
+        hour = min = 0;
+      }
+      value = nextBit(hours, hour);
+      if (value > 23) {
+        day++;
+        hour = min = 0;
+        continue;
+      }
+      if (value != hour) {
+        hour = value;
+        min = 0;
+      }
+      value = nextBit(minutes, min);
+      if (value > 59) {
+        hour++;
+        min = 0;
+        continue;
+      }
+      return (int64_t)daysFromCivil(year, month, day) * 86400 + hour * 3600 +
+             value * 60 - utc_offset_s;
+    }
+    return -1;
+  }
+
+  /// parses a comma separated list of values, ranges and steps
+  static bool parseField(const char *&pos, uint32_t min_value,
+                         uint32_t max_value, uint64_t &mask) {
+    mask = 0;
+    while (true) {
+      uint32_t from = min_value, to = max_value, step = 1;
+      if (*pos == '*') {
+        pos++;
+      } else {
+        if (!parseNumber(pos, from)) return false;
+        to = from;
+        if (*pos == '-') {
+          pos++;
+          if (!parseNumber(pos, to)) return false;
+        }
+      }
+      if (*pos == '/') {
+        pos++;
+        if (!parseNumber(pos, step) || step == 0) return false;
+        // "5/15" is the same as "5-max/15"
+        if (from == to) to = max_value;
+      }
+      if (from < min_value || to > max_value || from > to) return false;
+      for (uint32_t value = from; value <= to; value += step)
+        mask |= 1ull << value;
+      if (*pos != ',') break;
+      pos++;
+    }
+    return *pos == ' ' || *pos == 0;
+  }
+
+  static bool parseNumber(const char *&pos, uint32_t &value) {
+    if (*pos < '0' || *pos > '9') return false;
+    value = 0;
+    while (*pos >= '0' && *pos <= '9' && value < 100)
+      value = value * 10 + (*pos++ - '0');
+    return true;
+  }
+};
+
+}  // namespace low_power
@@ -10,7 +10,7 @@ namespace low_power {
  *
  */
 
-class ArduinoLowPowerTemplate : public ArduinoLowPowerCommon {
+class ArduinoLowPowerTemplate : public LP_COMMON(ArduinoLowPowerTemplate) {
  public:
 
   bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) {
@@ -33,7 +33,7 @@ class ArduinoLowPowerTemplate : public ArduinoLowPowerCommon {
   }
 
   /// sets processor into sleep mode
-  bool sleep(void) override {
+  bool sleep(void) LP_OVERRIDE {
     bool rc = false;
     switch (sleep_mode) {
       // In Modem-sleep mode, ESP8266 will close the Wi-Fi module circuit
@@ -56,15 +56,15 @@ class ArduinoLowPowerTemplate : public ArduinoLowPowerCommon {
     return rc;
   }
 
-  bool setSleepTime(uint32_t time, time_unit_t time_unit_type) override {
+  bool setSleepTime(uint64_t time, time_unit_t time_unit_type) LP_OVERRIDE {
     return true;
   }
 
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
     return true;
   }
 
-  bool isModeSupported(sleep_mode_enum_t sleep_mode) override {
+  bool isModeSupported(sleep_mode_enum_t sleep_mode) LP_OVERRIDE {
     return true;
   }
 
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <sys/time.h>
+
 #include "LowPowerCommon.h"
 #include "driver/gpio.h"
 #include "driver/rtc_io.h"
 #include "esp32-hal-touch.h"
+#include "esp_idf_version.h"
+#include "esp_pm.h"
 #include "esp_wifi.h"
 
 #define TOUCH_THREASHOLD 40
@@ -21,6 +25,88 @@ enum class wakeup_t { ext0, ext1 };
 
 #endif
 
+/// the power management configuration is target specific before IDF 5
+#if ESP_IDF_VERSION_MAJOR >= 5
+typedef esp_pm_config_t esp_pm_config_lp_t;
+#elif CONFIG_IDF_TARGET_ESP32S2
+typedef esp_pm_config_esp32s2_t esp_pm_config_lp_t;
+#elif CONFIG_IDF_TARGET_ESP32S3
+typedef esp_pm_config_esp32s3_t esp_pm_config_lp_t;
+#elif CONFIG_IDF_TARGET_ESP32C3
+typedef esp_pm_config_esp32c3_t esp_pm_config_lp_t;
+#else
+typedef esp_pm_config_esp32_t esp_pm_config_lp_t;
+#endif
+
+/**
+ * @brief Power management lock: while it is acquired the automatic light
+ * sleep is prevented (ESP_PM_NO_LIGHT_SLEEP) or the CPU (ESP_PM_CPU_FREQ_MAX)
+ * or APB (ESP_PM_APB_FREQ_MAX) clock is kept at the max frequency. The locks
+ * are counting, so the acquire() and release() calls can be nested. The
+ * driver lock is only created with the first acquire(), so that the object
+ * can be defined as global variable.
+ * @author Phil Schatzmann
+ */
+class PowerLock {
+ public:
+  PowerLock(esp_pm_lock_type_t type = ESP_PM_NO_LIGHT_SLEEP,
+            const char *name = "low_power") {
+    this->type = type;
+    this->name = name;
+  }
+  PowerLock(const PowerLock &) = delete;
+  PowerLock &operator=(const PowerLock &) = delete;
+
+  ~PowerLock() {
+    if (handle != nullptr) esp_pm_lock_delete(handle);
+  }
+
+  /// Acquires the lock: returns false if the power management is not
+  /// supported by the framework
+  bool acquire() {
+    if (handle == nullptr &&
+        esp_pm_lock_create(type, 0, name, &handle) != ESP_OK) {
+      handle = nullptr;
+      return false;
+    }
+    return esp_pm_lock_acquire(handle) == ESP_OK;
+  }
+
+  /// Releases the lock
+  bool release() {
+    if (handle == nullptr) return false;
+    return esp_pm_lock_release(handle) == ESP_OK;
+  }
+
+ protected:
+  esp_pm_lock_handle_t handle = nullptr;
+  esp_pm_lock_type_t type;
+  const char *name;
+};
+
+/**
+ * @brief Acquires a PowerLock for the lifetime of the object: use it to
+ * protect latency critical sections e.g.
+ * { PowerLockGuard guard(lock); ... }
+ * @author Phil Schatzmann
+ */
+class PowerLockGuard {
+ public:
+  PowerLockGuard(PowerLock &lock) : lock(lock) { lock.acquire(); }
+  PowerLockGuard(const PowerLockGuard &) = delete;
+  PowerLockGuard &operator=(const PowerLockGuard &) = delete;
+  ~PowerLockGuard() { lock.release(); }
+
+ protected:
+  PowerLock &lock;
+};
+
+/// setEpoch() was called: the RTC memory is only initialized at power on
+RTC_DATA_ATTR static bool lp_is_epoch_set = false;
+/// gpio of the ext0 wakeup: the LowPower object is constructed again after
+/// each deep sleep restart, so we keep it in a plain RTC variable
+RTC_DATA_ATTR static int lp_ext0_pin = -1;
+
 /**
  * @brief Low Power Management for ESP32:
  * - In Modem-sleep mode, ESP32 will close the Wi-Fi module circuit
@@ -34,6 +120,10 @@ enum class wakeup_t { ext0, ext1 };
  * - wakeup by touch pin
  * - supports multiple wakup sources
  * - supports modemSleep
+ * - wakeup by a program on the ULP coprocessor (see UlpProgram)
+ * - automatic light sleep and dynamic frequency scaling with the esp_pm
+ * driver: the chip sleeps whenever FreeRTOS is idle. Use a PowerLock for
+ * latency critical sections.
  *
  * Attention: at wakup of deep sleep we restart in setup.
  *
@@ -44,8 +134,14 @@ enum class wakeup_t { ext0, ext1 };
  *
  */
 
-class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
+class ArduinoLowPowerESP32 : public LP_COMMON(ArduinoLowPowerESP32) {
  public:
+  ArduinoLowPowerESP32() {
+#if LOW_POWER_PERIPHERALS
+    addRadioPeripheral();
+#endif
+  }
+
   bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) {
     bool result = false;
     switch (sleep_mode) {
@@ -66,47 +162,79 @@ class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
   }
 
   /// sets processor into sleep mode
-  bool sleep(void) override {
+  bool sleep(void) LP_OVERRIDE {
     LP_LOG("sleep");
+    beginSleep();
     switch (sleep_mode) {
       case sleep_mode_enum_t::lightSleep:
+        if (is_automatic_sleep && sleep_time_us > 0) {
+          // the power management enters the light sleep while we wait
+          enterSleep();
+          delayUs(sleep_time_us);
+          exitSleep(wakeup_cause_t::timer);
+          endSleep();
+          return true;
+        }
         LP_LOG("light sleep start");
+        enterSleep();
         esp_light_sleep_start();
+        exitSleep(toWakeupCause(esp_sleep_get_wakeup_cause()), 0,
+                  toWakeupPin(esp_sleep_get_wakeup_cause()));
+        // the sleep driver handles the wakeup: we record it as event
+        if (wakeup_info.cause != wakeup_cause_t::timer &&
+            wakeup_info.cause != wakeup_cause_t::undefined)
+          wake_events.push(wakeup_info.cause, wakeup_info.pin,
+                           wakeup_info.pin >= 0 ? digitalRead(wakeup_info.pin)
+                                                : 0);
+        endSleep();
         LP_LOG("light sleep end");
         return true;
       case sleep_mode_enum_t::deepSleep:
         LP_LOG("deep sleep start");
+        // the wakeup info is determined from the hardware after the restart
+        wakeup_info.cause = wakeup_cause_t::undefined;
+        monotonic_clock.saveBeforeRestart(sleep_time_us);
+        enterSleep();
         esp_deep_sleep_start();
         return true;
       case sleep_mode_enum_t::noSleep:
         wifiSetPS(WIFI_PS_NONE);
-        delay(sleep_time_us / 1000);
+        enterSleep();
+        delayUs(sleep_time_us);
+        exitSleep(wakeup_cause_t::timer);
+        endSleep();
         return true;
 
       case sleep_mode_enum_t::modemSleep:
+#if !LOW_POWER_PERIPHERALS
+        // w/o the peripheral registry we handle the radio directly
         wifiSetPS(WIFI_PS_MAX_MODEM);
-        delay(sleep_time_us / 1000);
-        //    wifiSetPS(WIFI_PS_MIN_MODEM);
+#endif
+        enterSleep();
+        delayUs(sleep_time_us);
+        exitSleep(wakeup_cause_t::timer);
+        endSleep();
         return true;
     }
     return false;
   }
 
-  bool setSleepTime(uint32_t time, time_unit_t time_unit) override {
+  bool setSleepTime(uint64_t time, time_unit_t time_unit) LP_OVERRIDE {
     if (sleep_mode == sleep_mode_enum_t::modemSleep) return false;
     sleep_time_us = toUs(time, time_unit);
     return esp_sleep_enable_timer_wakeup(toUs(time, time_unit)) == ESP_OK;
   }
 
 #if ESP_STD_SLEEP
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
     if (sleep_mode == sleep_mode_enum_t::modemSleep) return false;
     pin_mask |= 1 << pin;
     switch (change_type) {
       case pin_change_t::on_high: {
-        if (wakeup_type == wakeup_t::ext0)
+        if (wakeup_type == wakeup_t::ext0) {
           esp_sleep_enable_ext0_wakeup((gpio_num_t)pin, 1);
-        else
+          lp_ext0_pin = pin;
+        } else
           esp_sleep_enable_ext1_wakeup_io(pin_mask,
                                           ESP_EXT1_WAKEUP_ANY_HIGH);
 
@@ -117,9 +245,10 @@ class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
       } break;
 
       case pin_change_t::on_low: {
-        if (wakeup_type == wakeup_t::ext0)
+        if (wakeup_type == wakeup_t::ext0) {
           esp_sleep_enable_ext0_wakeup((gpio_num_t)pin, 0);
-        else
+          lp_ext0_pin = pin;
+        } else
           esp_sleep_enable_ext1_wakeup_io(pin_mask,
                                           ESP_EXT1_WAKEUP_ALL_LOW);
 
@@ -136,7 +265,7 @@ class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
 #endif
 
 #if CONFIG_IDF_TARGET_ESP32H2
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
     if (sleep_mode == sleep_mode_enum_t::modemSleep) return false;
 
     gpio_wakeup_enable((gpio_num_t)pin, change_type == pin_change_t::on_high
@@ -148,7 +277,7 @@ class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
 #endif
 
 #if !ESP_STD_SLEEP && !CONFIG_IDF_TARGET_ESP32H2
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
     if (sleep_mode == sleep_mode_enum_t::modemSleep) return false;
     pin_mask |= 1 << pin;
     if (sleep_mode == sleep_mode_enum_t::deepSleep) {
@@ -169,6 +298,20 @@ class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
   }
 #endif
 
+  /// deep sleep restarts the processor in setup()
+  sleep_mode_cost_t getSleepModeCost(sleep_mode_enum_t mode) LP_OVERRIDE {
+    switch (mode) {
+      case sleep_mode_enum_t::lightSleep:
+        return {200, 1000, false, 2640, 0};
+      case sleep_mode_enum_t::deepSleep:
+        return {500, 200000, true, 33, 0};
+      case sleep_mode_enum_t::modemSleep:
+        return {0, 0, false, 66000, 0};
+      default:
+        return {0, 0, false, 260000, 0};
+    }
+  }
+
   /// Wakup by touch pin
   bool addWakeupTouchPin(int pin, int touch_threshold = TOUCH_THREASHOLD) {
 #if ESP_STD_SLEEP
@@ -180,6 +323,16 @@ class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
 #endif
   }
 
+#if LOW_POWER_ULP_FSM
+  /// Runs the program on the ULP coprocessor with the indicated period
+  /// (also during the deep sleep): the program wakes up the main processor
+  /// e.g. when a sensor value crossed a threshold
+  bool addWakeupULP(UlpProgram &program, uint32_t period_us) {
+    if (!program.start(period_us)) return false;
+    return esp_sleep_enable_ulp_wakeup() == ESP_OK;
+  }
+#endif
+
   /**
     @brief There are two types for ESP32, ext0 and ext1 .
     ext0 uses RTC_IO to wakeup thus requires RTC peripherals
@@ -190,33 +343,159 @@ class ArduinoLowPowerESP32 : public ArduinoLowPowerCommon {
   */
   void setWakeupType(wakeup_t wakeup) { wakeup_type = wakeup; }
 
-  bool isModeSupported(sleep_mode_enum_t sleep_mode) override { return true; }
+  bool isModeSupported(sleep_mode_enum_t sleep_mode) LP_OVERRIDE { return true; }
+
+  /// After a deep sleep we restart in setup(): the wakeup cause and pin are
+  /// provided by the sleep driver
+  wakeup_info_t wakeupInfo() LP_OVERRIDE {
+    if (wakeup_info.cause == wakeup_cause_t::undefined &&
+        esp_reset_reason() == ESP_RST_DEEPSLEEP) {
+      esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+      return {toWakeupCause(cause), toWakeupPin(cause), nowUs(), true};
+    }
+    return wakeup_info;
+  }
+
+  /// Sets the system time: it is kept by the RTC timer during the light and
+  /// deep sleep
+  bool setEpoch(int64_t epoch) LP_OVERRIDE {
+    struct timeval tv = {(time_t)epoch, 0};
+    if (settimeofday(&tv, nullptr) != 0) return false;
+    lp_is_epoch_set = true;
+    return true;
+  }
+
+  /// Provides the system time: the deep sleep timer wakes us up with the
+  /// same RTC timer. Returns -1 if the time was neither set by setEpoch()
+  /// (also before a deep sleep) nor by e.g. SNTP (a time after 2020).
+  int64_t getEpochUs() LP_OVERRIDE {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    if (!lp_is_epoch_set && tv.tv_sec < min_valid_epoch) return -1;
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  }
 
   /// Reset to the initial state
-  void clear() override {
+  void clear() LP_OVERRIDE {
     ArduinoLowPowerCommon::clear();
     touch_pins.clear();
     wifiSetPS(WIFI_PS_NONE);
-    sleep_time_us = 0;
     pin_mask = 0;
+    endAutomaticSleep();
+#if LOW_POWER_PERIPHERALS
+    addRadioPeripheral();
+#endif
   }
 
   void setCpuFrequencyMhz(int mhz){
     ::setCpuFrequencyMhz(mhz);
   }
 
+  /// Activates the dynamic frequency scaling between min_mhz and max_mhz and
+  /// (with light_sleep) the light sleep whenever FreeRTOS is idle. This needs
+  /// a framework with CONFIG_PM_ENABLE and for the light sleep
+  /// CONFIG_FREERTOS_USE_TICKLESS_IDLE: returns false if this is not the
+  /// case.
+  bool setAutomaticSleep(int max_mhz, int min_mhz, bool light_sleep = true) {
+    esp_pm_config_lp_t config = {};
+    config.max_freq_mhz = max_mhz;
+    config.min_freq_mhz = min_mhz;
+    config.light_sleep_enable = light_sleep;
+    esp_err_t rc = esp_pm_configure(&config);
+    if (rc != ESP_OK) {
+      LP_LOGE("esp_pm_configure failed", rc);
+      return false;
+    }
+    is_automatic_sleep = light_sleep;
+    automatic_max_mhz = max_mhz;
+    return true;
+  }
+
+  /// Stops the automatic light sleep and the frequency scaling: the CPU
+  /// runs at the last max frequency
+  bool endAutomaticSleep() {
+    if (automatic_max_mhz == 0) return true;
+    bool rc = setAutomaticSleep(automatic_max_mhz, automatic_max_mhz, false);
+    automatic_max_mhz = 0;
+    return rc;
+  }
+
+  /// Returns true if the chip enters the light sleep automatically
+  bool isAutomaticSleep() { return is_automatic_sleep; }
+
  protected:
   wakeup_t wakeup_type = wakeup_t::ext1;
-  uint32_t sleep_time_us = 0;
+  /// 2020-01-01: older system times were not set by e.g. SNTP
+  static const time_t min_valid_epoch = 1577836800;
   std::vector<int> touch_pins;
   uint32_t pin_mask = 0;
+  bool is_automatic_sleep = false;
+  int automatic_max_mhz = 0;
+
+#if LOW_POWER_PERIPHERALS
+  /// The WiFi power save is only active in the modem sleep: remove the
+  /// "radio" peripheral to handle the WiFi in the sketch
+  void addRadioPeripheral() {
+    peripheral_registry.add("radio", suspendRadio, resumeRadio, nullptr, 0,
+                            false, 1 << (int)sleep_mode_enum_t::modemSleep);
+  }
 
-  void wifiSetPS(wifi_ps_type_t type) {
+  static bool suspendRadio(void *) {
+    wifiSetPS(WIFI_PS_MAX_MODEM);
+    return true;
+  }
+
+  static bool resumeRadio(void *) {
+    wifiSetPS(WIFI_PS_NONE);
+    return true;
+  }
+#endif
+
+  static void wifiSetPS(wifi_ps_type_t type) {
 #if !CONFIG_IDF_TARGET_ESP32H2
     esp_wifi_set_ps(type);
 #endif
   }
 
+  wakeup_cause_t toWakeupCause(esp_sleep_wakeup_cause_t cause) {
+    switch (cause) {
+      case ESP_SLEEP_WAKEUP_TIMER:
+        return wakeup_cause_t::timer;
+      case ESP_SLEEP_WAKEUP_EXT0:
+      case ESP_SLEEP_WAKEUP_EXT1:
+      case ESP_SLEEP_WAKEUP_GPIO:
+        return wakeup_cause_t::pin;
+      case ESP_SLEEP_WAKEUP_TOUCHPAD:
+        return wakeup_cause_t::touch;
+      case ESP_SLEEP_WAKEUP_UNDEFINED:
+        return wakeup_cause_t::undefined;
+      default:
+        return wakeup_cause_t::other;
+    }
+  }
+
+  /// Determines the gpio which woke us up (-1 if not known)
+  int toWakeupPin(esp_sleep_wakeup_cause_t cause) {
+    uint64_t mask = 0;
+    switch (cause) {
+#if ESP_STD_SLEEP
+      case ESP_SLEEP_WAKEUP_EXT0:
+        return lp_ext0_pin;
+      case ESP_SLEEP_WAKEUP_EXT1:
+        mask = esp_sleep_get_ext1_wakeup_status();
+        break;
+#endif
+#if SOC_GPIO_SUPPORT_DEEPSLEEP_WAKEUP
+      case ESP_SLEEP_WAKEUP_GPIO:
+        mask = esp_sleep_get_gpio_wakeup_status();
+        break;
+#endif
+      default:
+        break;
+    }
+    return mask == 0 ? -1 : __builtin_ctzll(mask);
+  }
+
   bool isTouchPin(int pin) {
     for (int tp : touch_pins) {
       if (tp == pin) return true;
@@ -27,8 +27,13 @@ namespace low_power {
  *
  */
 
-class ArduinoLowPowerESP8266 : public ArduinoLowPowerCommon {
+class ArduinoLowPowerESP8266 : public LP_COMMON(ArduinoLowPowerESP8266) {
  public:
+  ArduinoLowPowerESP8266() {
+#if LOW_POWER_PERIPHERALS
+    addRadioPeripheral();
+#endif
+  }
 
   bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) {
     bool result = false;
@@ -50,7 +55,7 @@ class ArduinoLowPowerESP8266 : public ArduinoLowPowerCommon {
   }
 
   /// sets processor into sleep mode
-  bool sleep(void) override {
+  bool sleep(void) LP_OVERRIDE {
     bool rc = false;
     switch (sleep_mode) {
       // In Modem-sleep mode, ESP8266 will close the Wi-Fi module circuit
@@ -68,12 +73,13 @@ class ArduinoLowPowerESP8266 : public ArduinoLowPowerCommon {
       // responsible for periodic wake-ups
       case sleep_mode_enum_t::deepSleep: {
         if (gpio_count != 0 || sleep_time_us == 0) return false;
-        system_deep_sleep_set_option(sleep_option);
-        if (is_instant)
-          system_deep_sleep(sleep_time_us);
-        else
-          system_deep_sleep_instant(sleep_time_us);
-
+        beginSleep();
+#if !LOW_POWER_PERIPHERALS
+        // w/o the peripheral registry we handle the radio directly
+        suspendRadio(this);
+#endif
+        enterSleep();
+        deepSleepChained(sleep_time_us);
         rc = true;
       } break;
 
@@ -85,14 +91,14 @@ class ArduinoLowPowerESP8266 : public ArduinoLowPowerCommon {
     return rc;
   }
 
-  bool setSleepTime(uint32_t time, time_unit_t time_unit_type) override {
+  bool setSleepTime(uint64_t time, time_unit_t time_unit_type) LP_OVERRIDE {
     if (sleep_mode == sleep_mode_enum_t::modemSleep) return false;
     setSleepMode(sleep_mode_enum_t::deepSleep);
     sleep_time_us = (toUs(time, time_unit_type));
     return gpio_count == 0;
   }
 
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
     if (sleep_mode == sleep_mode_enum_t::modemSleep) return false;
     setSleepMode(sleep_mode_enum_t::lightSleep);
     GPIO_INT_TYPE int_type = (change_type == pin_change_t::on_high)
@@ -103,6 +109,20 @@ class ArduinoLowPowerESP8266 : public ArduinoLowPowerCommon {
     return sleep_time_us == 0;
   }
 
+  /// deep sleep restarts the processor in setup()
+  sleep_mode_cost_t getSleepModeCost(sleep_mode_enum_t mode) LP_OVERRIDE {
+    switch (mode) {
+      case sleep_mode_enum_t::lightSleep:
+        return {0, 1000, false, 2970, 0};
+      case sleep_mode_enum_t::deepSleep:
+        return {1000, 300000, true, 66, 0};
+      case sleep_mode_enum_t::modemSleep:
+        return {0, 0, false, 49500, 0};
+      default:
+        return {0, 0, false, 231000, 0};
+    }
+  }
+
   /**
    * @brief Deep sleep options: values from 0 to 4
    * 1: RF calibration: Power consumption is high
@@ -111,26 +131,173 @@ class ArduinoLowPowerESP8266 : public ArduinoLowPowerCommon {
    */
   void setDeepSleepOption(uint8_t option) { sleep_option = option; }
 
+  /// Call at the beginning of setup(): if we woke up from an intermediate
+  /// deep sleep of a long sleep that exceeds the hardware maximum, we go
+  /// back to sleep immediately for the remaining time.
+  void resumeChainedSleep() {
+    chain_state_t state;
+    if (!readChainState(state) || state.remaining_us == 0) return;
+    if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE) {
+      writeChainState(0);
+      return;
+    }
+    deepSleepChained(state.remaining_us);
+  }
+
+  /// Saves the WiFi state to the RTC user memory before each deep sleep, so
+  /// that resumeWifi() can reconnect without scan, association and DHCP
+  void setWifiResume(bool flag) { is_wifi_resume = flag; }
+
+  /// Call in setup() after a deep sleep: resumes the WiFi from the state
+  /// that was saved before the deep sleep. If the state is invalid (e.g.
+  /// after a power on) or the resume fails we fall back to a normal login.
+  /// The resume may use half of the timeout, the login the remaining time.
+  /// Returns true if we are connected.
+  bool resumeWifi(const char *ssid, const char *password,
+                  uint32_t timeout_ms = 10000) {
+    uint32_t start_ms = millis();
+    is_wifi_resumed = false;
+    WiFiState state;
+    if (ESP.rtcUserMemoryRead(LOW_POWER_RTC_WIFI_OFFSET, (uint32_t *)&state,
+                              sizeof(state)) &&
+        WiFi.resumeFromShutdown(state)) {
+      is_wifi_resumed = waitForWifi(start_ms, timeout_ms / 2);
+    }
+    bool result = is_wifi_resumed;
+    if (!result) {
+      LP_LOGW("WiFi resume failed");
+      WiFi.persistent(false);
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(ssid, password);
+      result = waitForWifi(start_ms, timeout_ms);
+    }
+    wifi_reconnect_ms = millis() - start_ms;
+    return result;
+  }
+
+  /// Returns true if the last resumeWifi() could use the saved WiFi state
+  bool isWifiResumed() { return is_wifi_resumed; }
+
+  /// Time in ms which was needed by the last resumeWifi()
+  uint32_t wifiReconnectMs() { return wifi_reconnect_ms; }
+
   /// if instant == true -> instantly deep sleep w/o delay
   void setInstant(bool instant) { is_instant = instant; }
 
-  bool isModeSupported(sleep_mode_enum_t sleep_mode) override {
+  bool isModeSupported(sleep_mode_enum_t sleep_mode) LP_OVERRIDE {
     return true;
   }
 
+  /// The deep sleep always restarts the processor: the wakeup cause is
+  /// determined from the reset reason (the timer wakeup or an external
+  /// reset on the RST pin)
+  wakeup_info_t wakeupInfo() LP_OVERRIDE {
+    if (wakeup_info.cause != wakeup_cause_t::undefined) return wakeup_info;
+    switch (ESP.getResetInfoPtr()->reason) {
+      case REASON_DEEP_SLEEP_AWAKE:
+        return {wakeup_cause_t::timer, -1, nowUs(), true};
+      case REASON_EXT_SYS_RST:
+        return {wakeup_cause_t::pin, -1, nowUs(), true};
+      default:
+        return wakeup_info;
+    }
+  }
+
   void clear() {
     ArduinoLowPowerCommon::clear();
-    sleep_time_us = 0;
     sleep_option = 1;
     is_instant = false;
     gpio_count = 0;
+    is_wifi_resume = false;
+#if LOW_POWER_PERIPHERALS
+    addRadioPeripheral();
+#endif
   }
 
  protected:
-  uint64_t sleep_time_us = 0;
   uint8_t sleep_option = 1;  // 1 (rf calibration)
   bool is_instant = false;
   uint16_t gpio_count = 0;
+  bool is_wifi_resume = false;
+  bool is_wifi_resumed = false;
+  uint32_t wifi_reconnect_ms = 0;
+
+  /// remaining sleep time stored in the RTC user memory
+  struct chain_state_t {
+    uint64_t remaining_us;
+    uint32_t crc;
+  };
+
+  /// deep sleep for the max supported time and store the remaining time
+  void deepSleepChained(uint64_t total_us) {
+    // stay a bit below the max to allow for the calibration drift
+    uint64_t max_us = ESP.deepSleepMax() / 100 * 95;
+    uint64_t chunk_us = total_us > max_us ? max_us : total_us;
+    uint64_t remaining_us = total_us - chunk_us;
+    writeChainState(remaining_us);
+    monotonic_clock.saveBeforeRestart(chunk_us);
+    // intermediate wakeups do not need the radio
+    system_deep_sleep_set_option(remaining_us > 0 ? RF_DISABLED
+                                                  : sleep_option);
+    if (is_instant)
+      system_deep_sleep_instant(chunk_us);
+    else
+      system_deep_sleep(chunk_us);
+  }
+
+#if LOW_POWER_PERIPHERALS
+  /// The radio is shut down before the deep sleep: remove the "radio"
+  /// peripheral to handle the WiFi in the sketch
+  void addRadioPeripheral() {
+    peripheral_registry.add("radio", suspendRadio, nullptr, this, 0, false,
+                            1 << (int)sleep_mode_enum_t::deepSleep);
+  }
+#endif
+
+  /// saves the WiFi state if this was requested with setWifiResume(): the
+  /// deep sleep restarts the processor, so there is no resume hook
+  static bool suspendRadio(void *ref) {
+    ArduinoLowPowerESP8266 *self = (ArduinoLowPowerESP8266 *)ref;
+    if (self->is_wifi_resume) self->saveWifi();
+    return true;
+  }
+
+  /// shut down the WiFi and store the state (incl. its crc) in the RTC
+  /// user memory: if we are not connected the saved state is invalidated,
+  /// so that resumeWifi() does not use an old state
+  void saveWifi() {
+    static_assert(sizeof(WiFiState) <= (LOW_POWER_RTC_CLOCK_OFFSET -
+                                        LOW_POWER_RTC_WIFI_OFFSET) * 4,
+                  "WiFiState overlaps the clock state in the RTC memory");
+    WiFiState state;
+    if (WiFi.status() != WL_CONNECTED || !WiFi.shutdown(state))
+      memset(&state, 0, sizeof(state));
+    ESP.rtcUserMemoryWrite(LOW_POWER_RTC_WIFI_OFFSET, (uint32_t *)&state,
+                           sizeof(state));
+  }
+
+  bool waitForWifi(uint32_t start_ms, uint32_t timeout_ms) {
+    while (WiFi.status() != WL_CONNECTED) {
+      if (millis() - start_ms > timeout_ms) return false;
+      delay(10);
+    }
+    return true;
+  }
+
+  bool readChainState(chain_state_t &state) {
+    if (!ESP.rtcUserMemoryRead(LOW_POWER_RTC_CHAIN_OFFSET, (uint32_t *)&state,
+                               sizeof(state)))
+      return false;
+    return state.crc == crc32(&state.remaining_us, sizeof(state.remaining_us));
+  }
+
+  void writeChainState(uint64_t remaining_us) {
+    chain_state_t state;
+    state.remaining_us = remaining_us;
+    state.crc = crc32(&state.remaining_us, sizeof(state.remaining_us));
+    ESP.rtcUserMemoryWrite(LOW_POWER_RTC_CHAIN_OFFSET, (uint32_t *)&state,
+                           sizeof(state));
+  }
 };
 
 static ArduinoLowPowerESP8266 LowPower;
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+/// orders the memory accesses between the interrupt and the main loop
+#if defined(__AVR__)
+#  define LP_MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#  define LP_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+namespace low_power {
+
+/**
+ * @brief Lock free single producer / single consumer queue for the wakeup
+ * events: the wakeup interrupt adds the events and the application drains
+ * them after sleep() returned, so that no edge is lost while the main loop
+ * is busy. If the queue is full the new events are dropped and counted.
+ *
+ * The indexes are 8 bit, so that they can be updated atomically also on the
+ * AVR. Only one interrupt priority may push the events.
+ * @author Phil Schatzmann
+ */
+class WakeEventQueue {
+ public:
+  static const uint8_t capacity = LOW_POWER_EVENT_QUEUE_SIZE;
+  static_assert(capacity > 0 && capacity <= 128 &&
+                    (capacity & (capacity - 1)) == 0,
+                "LOW_POWER_EVENT_QUEUE_SIZE must be a power of 2");
+
+  /// Adds an event: call from the interrupt (producer)
+  bool push(const wake_event_t &event) {
+    uint8_t head = write_idx;
+    if ((uint8_t)(head - read_idx) == capacity) {
+      if (overflow_count < 0xFFFF) overflow_count++;
+      return false;
+    }
+    events[head & (capacity - 1)] = event;
+    LP_MEMORY_BARRIER();
+    write_idx = head + 1;
+    return true;
+  }
+
+  /// Adds an event with the actual time: call from the interrupt
+  bool push(wakeup_cause_t source, int pin, uint8_t level) {
+    wake_event_t event = {source, (int8_t)pin, level, (uint32_t)micros()};
+    return push(event);
+  }
+
+  /// Removes the oldest event: call from the main loop (consumer). Returns
+  /// false if the queue is empty.
+  bool pop(wake_event_t &event) {
+    uint8_t tail = read_idx;
+    if (tail == write_idx) return false;
+    LP_MEMORY_BARRIER();
+    event = events[tail & (capacity - 1)];
+    LP_MEMORY_BARRIER();
+    read_idx = tail + 1;
+    return true;
+  }
+
+  /// Number of queued events
+  uint8_t size() { return (uint8_t)(write_idx - read_idx); }
+
+  bool isEmpty() { return write_idx == read_idx; }
+
+  /// Number of events which were dropped because the queue was full
+  uint16_t overflows() {
+#if defined(__AVR__)
+    // 16 bit accesses are not atomic on the AVR
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t result = overflow_count;
+    SREG = sreg;
+    return result;
+#else
+    return overflow_count;
+#endif
+  }
+
+  /// Removes the queued events and resets the overflow counter: call from
+  /// the main loop
+  void clear() {
+    read_idx = write_idx;
+#if defined(__AVR__)
+    uint8_t sreg = SREG;
+    cli();
+    overflow_count = 0;
+    SREG = sreg;
+#else
+    overflow_count = 0;
+#endif
+  }
+
+ protected:
+  wake_event_t events[capacity];
+  volatile uint8_t write_idx = 0;
+  volatile uint8_t read_idx = 0;
+  volatile uint16_t overflow_count = 0;
+};
+
+}  // namespace low_power
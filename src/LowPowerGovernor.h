@@ -0,0 +1,159 @@
+#pragma once
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+namespace low_power {
+
+/// Accuracy of the predictions of the LowPowerGovernor
+struct governor_statistics_t {
+  /// number of predictions which were verified with the actual idle time
+  uint32_t predictions;
+  /// number of predictions where the selected mode was the optimal one
+  uint32_t mode_hits;
+  /// sum of the absolute prediction errors in us
+  uint64_t abs_error_us;
+};
+
+/**
+ * @brief Predictive idle governor (similar to the Linux cpuidle menu
+ * governor): we keep a history of the recent idle durations and predict the
+ * next idle time from the typical interval of the history, limited by the
+ * next known timer. Then we select the sleep mode with the lowest expected
+ * energy based on the entry/exit costs and the power of each mode.
+ *
+ * Use LowPower.setGovernor(governor) to let process() select the sleep mode.
+ * @author Phil Schatzmann
+ */
+class LowPowerGovernor {
+ public:
+  /// Predicts the next idle time: next_timer_us is the programmed sleep time
+  /// (0 if there is no timer)
+  time_us_t predictIdleUs(time_us_t next_timer_us) {
+    time_us_t typical_us = typicalIntervalUs();
+    time_us_t timer_us = next_timer_us > 0 ? next_timer_us : time_us_max;
+    predicted_us = typical_us > 0 && typical_us < timer_us ? typical_us
+                                                           : timer_us;
+    return predicted_us;
+  }
+
+  /// Selects the mode with the lowest expected energy for the indicated idle
+  /// time. The noSleep cost defines the active power.
+  sleep_mode_enum_t select(const sleep_mode_cost_t costs[sleep_mode_count],
+                           const bool supported[sleep_mode_count],
+                           time_us_t idle_us) {
+    static const sleep_mode_enum_t modes[] = {sleep_mode_enum_t::noSleep,
+                                              sleep_mode_enum_t::lightSleep,
+                                              sleep_mode_enum_t::deepSleep};
+    const sleep_mode_cost_t &active = costs[(int)sleep_mode_enum_t::noSleep];
+    sleep_mode_enum_t result = sleep_mode_enum_t::noSleep;
+    float min_energy = 0;
+    for (sleep_mode_enum_t mode : modes) {
+      if (!supported[(int)mode]) continue;
+      float energy = expectedEnergyUj(costs[(int)mode], active, idle_us);
+      if (mode == sleep_mode_enum_t::noSleep || energy < min_energy) {
+        min_energy = energy;
+        result = mode;
+      }
+    }
+    return result;
+  }
+
+  /// Records the actual idle time and compares it with the last prediction:
+  /// optimal_mode is the mode which would have been selected for the actual
+  /// idle time.
+  void addIdleTime(time_us_t actual_us, sleep_mode_enum_t selected_mode,
+                   sleep_mode_enum_t optimal_mode) {
+    history[history_pos] = actual_us;
+    history_pos = (history_pos + 1) % LOW_POWER_GOVERNOR_HISTORY;
+    if (history_count < LOW_POWER_GOVERNOR_HISTORY) history_count++;
+
+    if (predicted_us != time_us_max) {
+      stats.predictions++;
+      stats.abs_error_us += predicted_us > actual_us ? predicted_us - actual_us
+                                                     : actual_us - predicted_us;
+      if (selected_mode == optimal_mode) stats.mode_hits++;
+    }
+  }
+
+  /// Expected energy in uJ to spend idle_us in the indicated mode: during
+  /// the entry and exit we consume the active power
+  static float expectedEnergyUj(const sleep_mode_cost_t &cost,
+                                const sleep_mode_cost_t &active,
+                                time_us_t idle_us) {
+    // if we do not know the idle time we assume 1 hour
+    float idle = idle_us == time_us_max ? 3600e6f : (float)idle_us;
+    float transition = (float)cost.entry_us + cost.exit_us;
+    if (transition > idle) transition = idle;
+    return (transition * active.power_uw + (idle - transition) * cost.power_uw) /
+               1e6f +
+           cost.transition_uj;
+  }
+
+  /// Provides the prediction accuracy
+  const governor_statistics_t &statistics() { return stats; }
+
+  /// Share of the predictions which selected the optimal mode
+  float hitRatio() {
+    return stats.predictions == 0 ? 0.0f
+                                  : (float)stats.mode_hits / stats.predictions;
+  }
+
+  /// Mean absolute prediction error in us
+  time_us_t meanAbsErrorUs() {
+    return stats.predictions == 0 ? 0 : stats.abs_error_us / stats.predictions;
+  }
+
+  /// Resets the history and the statistics
+  void clear() {
+    history_count = 0;
+    history_pos = 0;
+    predicted_us = time_us_max;
+    stats = {0, 0, 0};
+  }
+
+ protected:
+  time_us_t history[LOW_POWER_GOVERNOR_HISTORY];
+  uint8_t history_count = 0;
+  uint8_t history_pos = 0;
+  time_us_t predicted_us = time_us_max;
+  governor_statistics_t stats = {0, 0, 0};
+
+  /// Determines the typical interval of the history: we drop the biggest
+  /// values until the remaining values are consistent. Returns 0 if there is
+  /// no typical interval (e.g. after a change of the wakeup pattern).
+  time_us_t typicalIntervalUs() {
+    if (history_count < LOW_POWER_GOVERNOR_HISTORY / 2) return 0;
+    time_us_t limit = time_us_max;
+    while (true) {
+      float sum = 0;
+      time_us_t max = 0;
+      int count = 0;
+      for (int j = 0; j < history_count; j++) {
+        if (history[j] > limit) continue;
+        sum += history[j];
+        if (history[j] > max) max = history[j];
+        count++;
+      }
+      // give up if we needed to drop more than a quarter of the values
+      if (count * 4 <= history_count * 3) return 0;
+      float avg = sum / count;
+      float variance = 0;
+      for (int j = 0; j < history_count; j++) {
+        if (history[j] > limit) continue;
+        float diff = history[j] - avg;
+        variance += diff * diff;
+      }
+      variance /= count;
+      // consistent if the standard deviation is small compared to the average
+      if (variance <= 400.0f || avg * avg > 36.0f * variance) {
+        return (time_us_t)avg;
+      }
+      // drop the biggest value
+      limit = max - 1;
+    }
+    return 0;
+  }
+};
+
+}  // namespace low_power
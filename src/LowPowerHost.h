@@ -0,0 +1,145 @@
+#pragma once
+
+#include "LowPowerCommon.h"
+#include "vector"
+
+namespace low_power {
+
+/**
+ * @brief Low Power Management simulation for the Host (e.g. Linux): The
+ * processor is emulated with a virtual monotonic clock. Sleeping advances the
+ * virtual time instantly up to the sleep end or the next injected pin event
+ * that matches a wakeup pin, so that long duty cycles can be simulated and
+ * benchmarked in seconds.
+ *
+ * Pin events can be injected with simulation().addPinEvent().
+ *
+ * @author Phil Schatzmann
+ */
+
+class ArduinoLowPowerHost : public LP_COMMON(ArduinoLowPowerHost) {
+ public:
+  /// we can do processing in all modes with the exception of deepSleep
+  bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) {
+    return sleep_mode != sleep_mode_enum_t::deepSleep;
+  }
+
+  /// sets processor into sleep mode: advances the virtual clock
+  bool sleep(void) LP_OVERRIDE {
+    bool rc = false;
+    wakeup_pin = -1;
+    beginSleep();
+    enterSleep();
+    switch (sleep_mode) {
+      case sleep_mode_enum_t::lightSleep:
+      case sleep_mode_enum_t::deepSleep:
+        rc = sleepUntilWakeup();
+        break;
+
+      case sleep_mode_enum_t::modemSleep:
+      case sleep_mode_enum_t::noSleep:
+        delayUs(sleep_time_us);
+        rc = true;
+        break;
+    }
+    exitSleep(wakeup_pin >= 0 ? wakeup_cause_t::pin : wakeup_cause_t::timer, 0,
+              wakeup_pin);
+    endSleep();
+    return rc;
+  }
+
+  bool setSleepTime(uint64_t time, time_unit_t time_unit_type) LP_OVERRIDE {
+    sleep_time_us = toUs(time, time_unit_type);
+    return true;
+  }
+
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
+    PinChangeDef pin_change_def{pin, change_type};
+    wakeup_pins.push_back(pin_change_def);
+    return true;
+  }
+
+  bool isModeSupported(sleep_mode_enum_t sleep_mode) LP_OVERRIDE { return true; }
+
+  /// Provides the simulated costs of the sleep mode
+  sleep_mode_cost_t getSleepModeCost(sleep_mode_enum_t mode) LP_OVERRIDE {
+    return costs[(int)mode];
+  }
+
+  /// Defines the simulated costs of the sleep mode
+  void setSleepModeCost(sleep_mode_enum_t mode, sleep_mode_cost_t cost) {
+    costs[(int)mode] = cost;
+  }
+
+  /// Reset to the initial state
+  void clear() LP_OVERRIDE {
+    ArduinoLowPowerCommon::clear();
+    wakeup_pin = -1;
+    wakeup_pins.clear();
+  }
+
+  /// Provides the simulation to inject pin events and to access the clock
+  HostSimulation &simulation() { return hostSimulation(); }
+
+ protected:
+  struct PinChangeDef {
+    int pin;
+    pin_change_t change_type;
+    PinChangeDef(int p, pin_change_t ct) {
+      pin = p;
+      change_type = ct;
+    }
+  };
+  std::vector<PinChangeDef> wakeup_pins;
+  int wakeup_pin = -1;
+  // noSleep, lightSleep, deepSleep, modemSleep
+  sleep_mode_cost_t costs[sleep_mode_count] = {{0, 0, false, 100000, 0},
+                                               {100, 1000, false, 1000, 0},
+                                               {1000, 10000, false, 10, 0},
+                                               {0, 0, false, 50000, 0}};
+
+  /// advance the time to the sleep end or the next wakeup pin event
+  bool sleepUntilWakeup() {
+    HostSimulation &sim = simulation();
+    bool has_timer = sleep_time_us > 0;
+    uint64_t end_us = sim.nowUs() + sleep_time_us;
+
+    // process the pin events in sequence until we find a wakeup
+    while (!sim.pendingEvents().empty()) {
+      HostSimulation::PinEvent evt = sim.pendingEvents().front();
+      if (has_timer && evt.time_us > end_us) break;
+      int old_level = sim.pinLevel(evt.pin);
+      sim.advanceTo(evt.time_us);
+      if (isWakeupEvent(evt, old_level)) {
+        wakeup_pin = evt.pin;
+        wake_event_t event = {wakeup_cause_t::pin, (int8_t)evt.pin,
+                              (uint8_t)evt.level, (uint32_t)evt.time_us};
+        wake_events.push(event);
+        return true;
+      }
+    }
+
+    // no wakeup source: we would sleep forever
+    if (!has_timer) {
+      LP_LOGW("no wakeup source");
+      return false;
+    }
+    sim.advanceTo(end_us);
+    return true;
+  }
+
+  bool isWakeupEvent(HostSimulation::PinEvent &evt, int old_level) {
+    for (auto &def : wakeup_pins) {
+      if (def.pin != evt.pin || old_level == evt.level) continue;
+      if (def.change_type == pin_change_t::on_high && evt.level == HIGH)
+        return true;
+      if (def.change_type == pin_change_t::on_low && evt.level == LOW)
+        return true;
+    }
+    return false;
+  }
+};
+
+static ArduinoLowPowerHost LowPower;
+
+}  // namespace low_power
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "LowPowerConfig.h"
+
+/**
+ * Logging which stays out of the sleep and wakeup path: the macros only
+ * record the message (a string literal), an optional value and the time in
+ * a ring buffer. The output is done by LowPower.flushLog() when the time
+ * critical processing is done. Messages below LOW_POWER_LOG_LEVEL are
+ * removed by the preprocessor, so they do not cost any flash or cycles.
+ * e.g. LP_LOGI("timeout ms", timeout_ms);
+ */
+#if LOW_POWER_LOG_LEVEL >= 1
+#  define LP_LOGE(...) low_power::lp_log.add(1, __VA_ARGS__)
+#else
+#  define LP_LOGE(...) ((void)0)
+#endif
+#if LOW_POWER_LOG_LEVEL >= 2
+#  define LP_LOGW(...) low_power::lp_log.add(2, __VA_ARGS__)
+#else
+#  define LP_LOGW(...) ((void)0)
+#endif
+#if LOW_POWER_LOG_LEVEL >= 3
+#  define LP_LOGI(...) low_power::lp_log.add(3, __VA_ARGS__)
+#else
+#  define LP_LOGI(...) ((void)0)
+#endif
+#if LOW_POWER_LOG_LEVEL >= 4
+#  define LP_LOGD(...) low_power::lp_log.add(4, __VA_ARGS__)
+#else
+#  define LP_LOGD(...) ((void)0)
+#endif
+/// debug message
+#define LP_LOG(msg) LP_LOGD(msg)
+
+#if LOW_POWER_LOG_LEVEL > 0
+
+namespace low_power {
+
+/// Binary log record
+struct log_record_t {
+  /// micros() when the message was recorded
+  uint32_t time_us;
+  /// string literal
+  const char *msg;
+  int32_t value;
+  uint8_t level;
+  bool has_value;
+};
+
+/**
+ * @brief Ring buffer for the log records: if it is full we drop the oldest
+ * record. Do not use it in interrupts.
+ * @author Phil Schatzmann
+ */
+class LowPowerLog {
+ public:
+  /// Records a message (string literal)
+  void add(uint8_t level, const char *msg) { add(level, msg, 0, false); }
+
+  /// Records a message (string literal) with a value
+  void add(uint8_t level, const char *msg, int32_t value) {
+    add(level, msg, value, true);
+  }
+
+  /// Removes the oldest record: returns false if there is none
+  bool pop(log_record_t &record) {
+    if (count == 0) return false;
+    record = records[start];
+    start = (start + 1) % LOW_POWER_LOG_SIZE;
+    count--;
+    return true;
+  }
+
+  /// Prints all records to the output (e.g. Serial)
+  template <class T>
+  void flush(T &out) {
+    static const char *levels[] = {"", "E ", "W ", "I ", "D "};
+    log_record_t record;
+    if (dropped_count > 0) {
+      out.print("W dropped log records: ");
+      out.println((unsigned long)dropped_count);
+      dropped_count = 0;
+    }
+    while (pop(record)) {
+      out.print((unsigned long)record.time_us);
+      out.print(" ");
+      out.print(levels[record.level]);
+      if (record.has_value) {
+        out.print(record.msg);
+        out.print(": ");
+        out.println((long)record.value);
+      } else {
+        out.println(record.msg);
+      }
+    }
+    out.flush();
+  }
+
+  /// Number of buffered records
+  uint16_t size() { return count; }
+
+  /// Number of records which were lost because the buffer was full
+  uint16_t dropped() { return dropped_count; }
+
+ protected:
+  log_record_t records[LOW_POWER_LOG_SIZE];
+  uint16_t start = 0;
+  uint16_t count = 0;
+  uint16_t dropped_count = 0;
+
+  void add(uint8_t level, const char *msg, int32_t value, bool has_value) {
+    if (count == LOW_POWER_LOG_SIZE) {
+      start = (start + 1) % LOW_POWER_LOG_SIZE;
+      count--;
+      dropped_count++;
+    }
+    records[(start + count) % LOW_POWER_LOG_SIZE] = {micros(), msg, value,
+                                                     level, has_value};
+    count++;
+  }
+};
+
+/// Log which is used by the LP_LOG macros
+static LowPowerLog lp_log;
+
+}  // namespace low_power
+
+#endif
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <string.h>
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+namespace low_power {
+
+/// Suspend or resume hook of a peripheral: returns false if it failed
+typedef bool (*peripheral_hook_t)(void *ref);
+
+/// Registered peripheral with the measured duration of its hooks
+struct peripheral_t {
+  const char *name;
+  peripheral_hook_t suspend;
+  peripheral_hook_t resume;
+  void *ref;
+  /// dependency level: peripherals with a higher priority (e.g. a bus) are
+  /// suspended after and resumed before the ones with a lower priority
+  /// (e.g. a sensor on the bus)
+  int8_t priority;
+  /// the peripheral is needed by a wakeup source and is not suspended
+  bool is_wakeup_source;
+  /// bitmask of the sleep modes (bit n = sleep_mode_enum_t n) which suspend
+  /// the peripheral
+  uint8_t sleep_modes;
+  bool is_suspended;
+  /// duration of the last suspend
+  uint32_t suspend_us;
+  /// duration of the last resume
+  uint32_t resume_us;
+  /// longest resume
+  uint32_t max_resume_us;
+};
+
+/**
+ * @brief Registry of the peripherals (e.g. UART, I2C, SPI, USB, ADC, radio)
+ * which need to be suspended before the sleep and resumed after the
+ * wakeup: sleep() calls the suspend hooks in the sequence of the ascending
+ * priority and the resume hooks in the reverse sequence. The duration of
+ * each hook is measured, so that we can find the hooks which slow down the
+ * wakeup.
+ *
+ * Use LowPower.peripherals().add(...) to register a peripheral.
+ * @author Phil Schatzmann
+ */
+class PeripheralRegistry {
+ public:
+  /// Registers the hooks of a peripheral: by default the peripheral is
+  /// suspended in the light and deep sleep
+  bool add(const char *name, peripheral_hook_t suspend,
+           peripheral_hook_t resume, void *ref = nullptr, int8_t priority = 0,
+           bool is_wakeup_source = false,
+           uint8_t sleep_modes = default_sleep_modes) {
+    if (count >= LOW_POWER_MAX_PERIPHERALS || find(name) != nullptr)
+      return false;
+    // keep the entries sorted by the priority
+    int pos = count;
+    while (pos > 0 && entries[pos - 1].priority > priority) {
+      entries[pos] = entries[pos - 1];
+      pos--;
+    }
+    entries[pos] = {name,     suspend,     resume, ref, priority,
+                    is_wakeup_source, sleep_modes, false,  0,   0,
+                    0};
+    count++;
+    return true;
+  }
+
+  /// Removes the peripheral
+  bool remove(const char *name) {
+    peripheral_t *entry = find(name);
+    if (entry == nullptr) return false;
+    for (peripheral_t *p = entry; p < entries + count - 1; p++) *p = *(p + 1);
+    count--;
+    return true;
+  }
+
+  /// Marks the peripheral as needed by a wakeup source, so that it stays
+  /// active during the sleep
+  bool setWakeupSource(const char *name, bool flag) {
+    peripheral_t *entry = find(name);
+    if (entry == nullptr) return false;
+    entry->is_wakeup_source = flag;
+    return true;
+  }
+
+  /// Calls the suspend hooks which are relevant for the sleep mode
+  void suspend(sleep_mode_enum_t mode) {
+    for (int j = 0; j < count; j++) {
+      peripheral_t &entry = entries[j];
+      if (entry.is_suspended || entry.is_wakeup_source ||
+          (entry.sleep_modes & (1 << (int)mode)) == 0)
+        continue;
+      uint32_t start_us = micros();
+      bool ok = entry.suspend == nullptr || entry.suspend(entry.ref);
+      entry.suspend_us = micros() - start_us;
+      entry.is_suspended = ok;
+    }
+  }
+
+  /// Calls the resume hooks of the suspended peripherals in the reverse
+  /// sequence
+  void resume() {
+    for (int j = count - 1; j >= 0; j--) {
+      peripheral_t &entry = entries[j];
+      if (!entry.is_suspended) continue;
+      uint32_t start_us = micros();
+      if (entry.resume != nullptr) entry.resume(entry.ref);
+      entry.resume_us = micros() - start_us;
+      if (entry.resume_us > entry.max_resume_us)
+        entry.max_resume_us = entry.resume_us;
+      entry.is_suspended = false;
+    }
+  }
+
+  /// Provides the peripheral with the indicated name or nullptr
+  peripheral_t *find(const char *name) {
+    for (int j = 0; j < count; j++) {
+      if (strcmp(entries[j].name, name) == 0) return &entries[j];
+    }
+    return nullptr;
+  }
+
+  /// Provides the peripheral with the longest resume or nullptr
+  const peripheral_t *slowestResume() {
+    const peripheral_t *result = nullptr;
+    for (int j = 0; j < count; j++) {
+      if (result == nullptr || entries[j].max_resume_us > result->max_resume_us)
+        result = &entries[j];
+    }
+    return result;
+  }
+
+  /// Number of registered peripherals
+  int size() { return count; }
+
+  /// Provides the peripheral at the indicated position (sorted by priority)
+  const peripheral_t &operator[](int idx) { return entries[idx]; }
+
+  /// Removes all peripherals
+  void clear() { count = 0; }
+
+ protected:
+  static const uint8_t default_sleep_modes =
+      (1 << (int)sleep_mode_enum_t::lightSleep) |
+      (1 << (int)sleep_mode_enum_t::deepSleep);
+  peripheral_t entries[LOW_POWER_MAX_PERIPHERALS];
+  int count = 0;
+};
+
+}  // namespace low_power
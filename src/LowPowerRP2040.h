@@ -1,20 +1,35 @@
 #pragma once
 
 #include "LowPowerCommon.h"
+#include "drivers/rp2040/pico_rtc_utils.h"
 #include "drivers/rp2040/pico_sleep.h"
+#include "hardware/clocks.h"
+#include "hardware/pll.h"
+#include "hardware/sync.h"
 #include "hardware/vreg.h"
+#include "hardware/watchdog.h"
+#include "pico/time.h"
 #include "vector"
 
 namespace low_power {
 
+/// System clock and voltage which is used during the light sleep
+struct light_sleep_step_t {
+  uint32_t sys_khz;
+  enum vreg_voltage voltage;
+};
+
 class ArduinoLowPowerRP2040;
 static ArduinoLowPowerRP2040 *selfArduinoLowPowerRP2040 = nullptr;
 
 /**
  * @brief Low Power Management for RP2040: In lightSleep we just reduce the
- * processor system clock and voltage. In deepSleep we actually set the
- * processor as dormant, but we must choose between the wakeup by a pin or a
- * timer based wakeup. Only one single wakeup gpio pin is supported!
+ * processor system clock and voltage (see setLightSleepSteps()) and restore
+ * the original clock tree afterwards. In deepSleep we actually set the
+ * processor as dormant when we wake up by pins only: any number of wakeup
+ * pins is supported. If pins are combined with a sleep time we sleep with the
+ * timer and the gpio interrupts active, so that the first source wakes us up.
+ * wakeupInfo() reports the source.
  *
  * @author Phil Schatzmann
  * for details see
@@ -25,9 +40,25 @@ static ArduinoLowPowerRP2040 *selfArduinoLowPowerRP2040 = nullptr;
  *
  */
 
-class ArduinoLowPowerRP2040 : public ArduinoLowPowerCommon {
+class ArduinoLowPowerRP2040 : public LP_COMMON(ArduinoLowPowerRP2040) {
  public:
-  ArduinoLowPowerRP2040() { selfArduinoLowPowerRP2040 = this; }
+  ArduinoLowPowerRP2040() {
+    selfArduinoLowPowerRP2040 = this;
+#if LOW_POWER_PERIPHERALS
+    addDefaultPeripherals();
+#endif
+    // the record of a forced restart is only consumed once: the scratch
+    // registers also survive unrelated resets
+    if ((watchdog_hw->scratch[0] & 0xFFFFFF00) != restart_magic) return;
+    if (watchdog_caused_reboot()) {
+      // continue the monotonic clock
+      monotonic_clock.addSleptUs(((time_us_t)watchdog_hw->scratch[3] << 32) |
+                                 watchdog_hw->scratch[2]);
+      restart_info = {(wakeup_cause_t)(watchdog_hw->scratch[0] & 0xFF),
+                      (int)watchdog_hw->scratch[1], nowUs(), true};
+    }
+    watchdog_hw->scratch[0] = 0;
+  }
 
   bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) {
     bool result = false;
@@ -49,82 +80,193 @@ class ArduinoLowPowerRP2040 : public ArduinoLowPowerCommon {
   }
 
   /// sets processor into sleep mode
-  bool sleep(void) override {
-    bool rc = false;
+  bool sleep(void) LP_OVERRIDE {
+    // a deep sleep needs a wakeup source: we would never wake up again
+    if (sleep_mode == sleep_mode_enum_t::deepSleep &&
+        wakeup_pins.size() == 0 && sleep_time_us == 0)
+      return false;
+    beginSleep();
     switch (sleep_mode) {
       case sleep_mode_enum_t::lightSleep: {
-        int idx = 0;
-        for (auto pin : wakeup_pins) {
-          attachInterrupt(digitalPinToInterrupt(pin.pin), interrupt_cb,
-                          toMode(pin.change_type));
-          is_wait_for_pin = true;
-        }
-        if (is_wait_for_pin) {
-          light_sleep_begin();
-          while (is_wait_for_pin) delay(timer_update_delay);
-          light_sleep_end();
+        if (wakeup_pins.size() > 0) {
+          light_sleep_wait_for_pin();
         } else {
           light_sleep();
         }
-      } break;
+        endSleep();
+        return true;
+      }
 
       case sleep_mode_enum_t::deepSleep: {
-        // use wakup pins
-        if (wakeup_pins.size() >= 0) {
-          if (wakeup_pins.size() > 1) return false;
-          if (wakeup_pins[0].change_type == pin_change_t::on_high) {
-            sleep_goto_dormant_until_edge_high(wakeup_pins[0].pin);
-          } else {
-            sleep_goto_dormant_until_edge_low(wakeup_pins[0].pin);
-          }
-        } else if (sleep_time_us > 0) {
-          // use time to sleep
-          sleep_goto_sleep_for(sleep_time_us / 1000, timer_cb);
-          if (is_restart) rp2040.reboot();
-
+        if (wakeup_pins.size() > 0 && sleep_time_us > 0) {
+          // timer or pins: we sleep with the timer and the gpio irqs active
+          deep_sleep_timer_or_pins();
+        } else if (wakeup_pins.size() > 0) {
+          // use wakup pins: dormant stops all clocks
+          deep_sleep_dormant();
         } else {
-          // no wakeup !
-          processor_deep_sleep();
-          if (is_restart) rp2040.reboot();
+          // use time to sleep: the alarm only supports 32 bit us
+          enterSleep();
+          sleepChained(sleep_time_us, max_alarm_us, [](time_us_t us) {
+            return sleep_goto_sleep_for(us / 1000, timer_cb);
+          });
+          wakeup_us = time_us_64();
+          exitSleep(wakeup_cause_t::timer);
+          deep_sleep_resume();
         }
+        endSleep();
         return true;
       }
 
       case sleep_mode_enum_t::modemSleep:
-        delay(sleep_time_us / 1000);
+        enterSleep();
+        delayUs(sleep_time_us);
+        exitSleep(wakeup_cause_t::timer);
+        endSleep();
         return true;
 
       case sleep_mode_enum_t::noSleep:
-        delay(sleep_time_us / 1000);
-        light_sleep_end();        
+        enterSleep();
+        delayUs(sleep_time_us);
+        exitSleep(wakeup_cause_t::timer);
+        endSleep();
         return true;
     }
+    endSleep();
 
     return false;
   }
 
-  bool setSleepTime(uint32_t time, time_unit_t time_unit_type) override {
+  /// the sleep time can be combined with wakeup pins
+  bool setSleepTime(uint64_t time, time_unit_t time_unit_type) LP_OVERRIDE {
     sleep_time_us = (toUs(time, time_unit_type));
-    return sleep_mode == sleep_mode_enum_t::lightSleep ||
-           wakeup_pins.size() == 0;
+    return true;
   }
 
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  /// any number of wakeup pins is supported: the interrupt stays attached,
+  /// so that the changes are also recorded in wakeEvents() while we are
+  /// processing
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
     PinChangeDef pin_change_def{pin, change_type};
     wakeup_pins.push_back(pin_change_def);
-    return sleep_mode == sleep_mode_enum_t::lightSleep || sleep_time_us == 0;
+    attachInterruptParam(digitalPinToInterrupt(pin), interrupt_cb,
+                         toMode(change_type), (void *)(intptr_t)pin);
+    return true;
   }
 
   void clear() {
     ArduinoLowPowerCommon::clear();
-    sleep_time_us = 0;
     is_wait_for_pin = false;
+    for (auto pin : wakeup_pins) {
+      detachInterrupt(digitalPinToInterrupt(pin.pin));
+    }
     wakeup_pins.clear();
+#if LOW_POWER_PERIPHERALS
+    addDefaultPeripherals();
+#endif
+  }
+
+  /// light sleep needs to switch the system clock and voltage
+  sleep_mode_cost_t getSleepModeCost(sleep_mode_enum_t mode) LP_OVERRIDE {
+    switch (mode) {
+      case sleep_mode_enum_t::lightSleep:
+        return {4000, 2000, is_restart, 16500, 0};
+      case sleep_mode_enum_t::deepSleep:
+        return {100, 1000, is_restart, 2640, 0};
+      default:
+        return {0, 0, false, 82500, 0};
+    }
+  }
+
+  /// Time in us from the last wakeup until the processing was ready again
+  /// (light sleep: from the pin interrupt; deep sleep: incl. the restore of
+  /// the oscillators and clocks)
+  uint32_t getWakeupLatencyUs() { return wakeup_latency_us; }
+
+  /// Defines the sequence of system clock frequencies and voltages which are
+  /// applied at the start of the light sleep: frequencies below the PLL range
+  /// are derived from the crystal oscillator. The original clocks and the
+  /// voltage are restored after the light sleep.
+  void setLightSleepSteps(const light_sleep_step_t *steps, int count) {
+    light_sleep_steps = steps;
+    light_sleep_step_count = count;
+  }
+
+  /// Sets the RTC: it keeps the calendar time in all sleep modes
+  bool setEpoch(int64_t epoch) LP_OVERRIDE {
+    if (!rtc_running()) rtc_init();
+    datetime_t dt;
+    time_t time = (time_t)epoch;
+    if (!rtc_set_datetime(epoch_to_datetime(&time, &dt))) return false;
+    // the new value is visible after 3 RTC clock cycles
+    sleep_us(64);
+    sync_epoch_us = epoch * 1000000;
+    sync_us = time_us_64();
+    return ArduinoLowPowerCommon::setEpoch(epoch);
+  }
+
+  /// Provides the time of the RTC: it only has a resolution of 1 second, so
+  /// we interpolate with time_us_64() from the last known change of the
+  /// second and keep the result within the second of the RTC
+  int64_t getEpochUs() LP_OVERRIDE {
+    if (!rtc_running()) return ArduinoLowPowerCommon::getEpochUs();
+    datetime_t dt;
+    rtc_get_datetime(&dt);
+    int64_t rtc_us = (int64_t)datetime_to_epoch(&dt, nullptr) * 1000000;
+    uint64_t now_us = time_us_64();
+    int64_t result = sync_epoch_us + (int64_t)(now_us - sync_us);
+    if (result >= rtc_us && result < rtc_us + 1000000) return result;
+    // the second changed at a different time than estimated (or the timer
+    // was stopped): we continue from the nearest valid time
+    result = result < rtc_us ? rtc_us : rtc_us + 999999;
+    sync_epoch_us = result;
+    sync_us = now_us;
+    return result;
+  }
+
+  /// In deepSleep we program the RTC alarm with the calendar time and stop
+  /// all other clocks: the RTC must have been set with setEpoch(). With
+  /// wakeup pins we use the regular deep sleep for the remaining time.
+  bool sleepUntil(int64_t epoch) LP_OVERRIDE {
+    if (sleep_mode != sleep_mode_enum_t::deepSleep || !rtc_running() ||
+        wakeup_pins.size() > 0)
+      return ArduinoLowPowerCommon::sleepUntil(epoch);
+    int64_t start_epoch_us = getEpochUs();
+    if (epoch * 1000000 <= start_epoch_us) return true;
+    datetime_t dt;
+    time_t time = (time_t)epoch;
+    epoch_to_datetime(&time, &dt);
+    beginSleep();
+    save_clocks();
+    sleep_run_from_xosc();
+    uint64_t start_us = time_us_64();
+    enterSleep();
+    sleep_goto_sleep_until(&dt, rtc_cb);
+    wakeup_us = time_us_64();
+    // the timer is stopped: we measure the sleep with the RTC. The alarm
+    // wakes us up at the change of the second, so getEpochUs() continues
+    // from the start of the second
+    int64_t slept_us = getEpochUs() - start_epoch_us -
+                       (int64_t)(wakeup_us - start_us);
+    exitSleep(wakeup_cause_t::timer, slept_us > 0 ? slept_us : 0);
+    deep_sleep_resume();
+    endSleep();
+    return true;
   }
 
-  /// We force a restart after we wake up from sleep
+  /// We force a restart after we wake up from sleep: by default we resume
+  /// the processing and keep the RAM
   void setRestart(bool flag) { is_restart = flag; }
 
+  /// After a forced restart the wakeup info and the time are provided by the
+  /// watchdog scratch registers
+  wakeup_info_t wakeupInfo() LP_OVERRIDE {
+    if (wakeup_info.cause == wakeup_cause_t::undefined &&
+        restart_info.is_restart)
+      return restart_info;
+    return wakeup_info;
+  }
+
  protected:
   struct PinChangeDef {
     int pin;
@@ -135,16 +277,58 @@ class ArduinoLowPowerRP2040 : public ArduinoLowPowerCommon {
     }
   };
   std::vector<PinChangeDef> wakeup_pins;
-  uint64_t sleep_time_us = 0;
-  bool is_wait_for_pin = false;
+  volatile bool is_wait_for_pin = false;
+  volatile uint64_t wakeup_irq_us = 0;
+  uint64_t wakeup_us = 0;
+  uint32_t wakeup_latency_us = 0;
   bool is_restart = false;
+  /// epoch and time_us_64() at the last known change of the RTC second
+  int64_t sync_epoch_us = 0;
+  uint64_t sync_us = 0;
+  /// wakeup info which was read from the scratch registers after a restart
+  wakeup_info_t restart_info = {wakeup_cause_t::undefined, -1, 0, false};
+  volatile int wakeup_pin = -1;
+  /// marks the wakeup info in the watchdog scratch register 0
+  static const uint32_t restart_magic = 0x4C505700;
   int timer_update_delay = 2;
+  /// default: 10 MHz at 0.95 V (0.85 V was not stable)
+  const light_sleep_step_t default_light_sleep_steps[1] = {
+      {10000, VREG_VOLTAGE_0_95}};
+  const light_sleep_step_t *light_sleep_steps = default_light_sleep_steps;
+  int light_sleep_step_count = 1;
+
+  /// Snapshot of the clock tree before the sleep
+  sleep_clock_snapshot_t clock_snapshot = {false};
+  /// max sleep time of a hardware alarm: we stay below 2^32 us
+  const time_us_t max_alarm_us = 60ull * 60 * 1000000;
 
   static void timer_cb(unsigned int) {}
 
-  static void interrupt_cb() {
+  static void rtc_cb() {}
+
+  static void interrupt_cb(void *pin) {
+    int gpio = (int)(intptr_t)pin;
+    selfArduinoLowPowerRP2040->wake_events.push(wakeup_cause_t::pin, gpio,
+                                                gpio_get(gpio));
+    if (!selfArduinoLowPowerRP2040->is_wait_for_pin) return;
+    selfArduinoLowPowerRP2040->wakeup_irq_us = time_us_64();
+    selfArduinoLowPowerRP2040->wakeup_pin = (int)(intptr_t)pin;
     selfArduinoLowPowerRP2040->is_wait_for_pin = false;
-    if (selfArduinoLowPowerRP2040->is_restart) rp2040.reboot();
+    // wake up the core from the __wfe()
+    __sev();
+    if (selfArduinoLowPowerRP2040->is_restart)
+      reboot(wakeup_cause_t::pin, (int)(intptr_t)pin);
+  }
+
+  /// reboot and keep the wakeup info and the time in the watchdog scratch
+  /// registers which survive the reset
+  static void reboot(wakeup_cause_t cause, int pin) {
+    time_us_t now_us = selfArduinoLowPowerRP2040->nowUs();
+    watchdog_hw->scratch[0] = restart_magic | (uint32_t)cause;
+    watchdog_hw->scratch[1] = (uint32_t)pin;
+    watchdog_hw->scratch[2] = (uint32_t)now_us;
+    watchdog_hw->scratch[3] = (uint32_t)(now_us >> 32);
+    rp2040.reboot();
   }
 
   PinStatus toMode(pin_change_t ct) {
@@ -158,36 +342,154 @@ class ArduinoLowPowerRP2040 : public ArduinoLowPowerCommon {
     }
   }
 
+  /// dormant until any of the wakeup pins changes
+  void deep_sleep_dormant() {
+    std::vector<sleep_wakeup_pin_t> pins;
+    for (auto &pin : wakeup_pins) {
+      pins.push_back(
+          {(uint)pin.pin, true, pin.change_type == pin_change_t::on_high});
+    }
+    // dormant needs a clock source which can be stopped
+    save_clocks();
+    sleep_run_from_xosc();
+    enterSleep();
+    int idx = sleep_goto_dormant_until_pins(pins.data(), pins.size());
+    wakeup_us = time_us_64();
+    // the timer is stopped in dormant mode: the monotonic clock does not
+    // include the dormant time
+    exitSleep(wakeup_cause_t::pin, 0, idx >= 0 ? wakeup_pins[idx].pin : -1);
+    deep_sleep_resume();
+  }
+
+  /// continue after the deep sleep with the restored clocks and RAM: a
+  /// reboot is only done if this was requested with setRestart()
+  void deep_sleep_resume() {
+    if (is_restart) reboot(wakeup_info.cause, wakeup_info.pin);
+    sleep_power_up();
+    restore_clocks();
+    wakeup_latency_us = time_us_64() - wakeup_us;
+  }
+
+  /// sleep with the timer alarm and the gpio interrupts: dormant is not
+  /// possible because it would stop the timer
+  void deep_sleep_timer_or_pins() {
+    is_wait_for_pin = true;
+    enterSleep();
+    sleepChained(sleep_time_us, max_alarm_us, [](time_us_t us) {
+      sleep_goto_sleep_for_or_gpio(us / 1000, timer_cb);
+      // stop the chain on a pin wakeup
+      return selfArduinoLowPowerRP2040->is_wait_for_pin;
+    });
+    wakeup_us = time_us_64();
+    bool is_pin = !is_wait_for_pin;
+    is_wait_for_pin = false;
+    if (is_pin)
+      exitSleep(wakeup_cause_t::pin, 0, wakeup_pin);
+    else
+      exitSleep(wakeup_cause_t::timer);
+    deep_sleep_resume();
+  }
+
+  /// waits with __wfe() until a pin interrupt or the optional sleep time
+  void light_sleep_wait_for_pin() {
+    is_wait_for_pin = true;
+    light_sleep_begin();
+    absolute_time_t timeout = sleep_time_us > 0
+                                  ? make_timeout_time_us(sleep_time_us)
+                                  : at_the_end_of_time;
+    enterSleep();
+    bool is_timeout = false;
+    while (is_wait_for_pin && !is_timeout) {
+      is_timeout = best_effort_wfe_or_timeout(timeout);
+    }
+    is_wait_for_pin = false;
+    if (is_timeout) {
+      exitSleep(wakeup_cause_t::timer);
+      light_sleep_end();
+    } else {
+      exitSleep(wakeup_cause_t::pin, 0, wakeup_pin);
+      light_sleep_end();
+      wakeup_latency_us = time_us_64() - wakeup_irq_us;
+    }
+  }
+
   void light_sleep() {
     light_sleep_begin();
-    delay(sleep_time_us / 1000);
+    enterSleep();
+    delayUs(sleep_time_us);
+    exitSleep(wakeup_cause_t::timer);
     light_sleep_end();
   }
 
   void light_sleep_begin() {
     delay(timer_update_delay);
-    set_sys_clock_khz(
-        10000,
-        false);  // Set System clock to 10 MHz, sys_clock_khz(10000,
-                 // true); did not work for me
+    save_clocks();
+    // reduce the frequency before the voltage
+    for (int j = 0; j < light_sleep_step_count; j++) {
+      const light_sleep_step_t &step = light_sleep_steps[j];
+      if (!set_sys_clock_khz(step.sys_khz, false)) {
+        // below the PLL range: divide the crystal oscillator
+        uint32_t hz = step.sys_khz * 1000;
+        if (hz > XOSC_MHZ * MHZ) continue;
+        clock_configure(clk_sys,
+                        CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+                        CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_XOSC_CLKSRC,
+                        XOSC_MHZ * MHZ, hz);
+        clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS,
+                        hz, hz);
+        pll_deinit(pll_sys);
+      }
+      vreg_set_voltage(step.voltage);
+    }
     delay(timer_update_delay);
-    vreg_set_voltage(VREG_VOLTAGE_0_95);  // 0.85V did not work, 0.95V
-                                          // seetime_unit_t::ms pretty stable
   }
+
   void light_sleep_end() {
-    if (is_restart) rp2040.reboot();
-    vreg_set_voltage(
-        VREG_VOLTAGE_DEFAULT);  // corresponds to 1.10V, not sure if
-                                // that is really required for 48 MHz
-    set_sys_clock_48mhz();      // Set System clock back to 48 MHz
+    if (is_restart) reboot(wakeup_info.cause, wakeup_info.pin);
+    restore_clocks();
     delay(timer_update_delay);
   }
 
-  inline void sleep_goto_dormant_until_edge_high(uint gpio_pin) {
-    sleep_goto_dormant_until_pin(gpio_pin, true, true);
+  /// records the sys pll, the peripheral clock and the core voltage
+  void save_clocks() { sleep_save_clocks(&clock_snapshot); }
+
+  /// restores the recorded clocks: we increase the voltage before the
+  /// frequency
+  void restore_clocks() { sleep_restore_clocks(&clock_snapshot); }
+
+#if LOW_POWER_PERIPHERALS
+  /// The UARTs keep their configuration because we restore clk_peri after
+  /// the sleep, so we only send the pending data. The USB device stops with
+  /// the USB PLL in the deep sleep. Remove the "uart" or "usb" peripheral to
+  /// handle them in the sketch.
+  void addDefaultPeripherals() {
+    peripheral_registry.add("uart", suspendUART, nullptr, nullptr, 90);
+    peripheral_registry.add("usb", suspendUSB, resumeUSB, nullptr, 100, false,
+                            1 << (int)sleep_mode_enum_t::deepSleep);
+  }
+#endif
+
+  static bool suspendUART(void *) {
+    Serial1.flush();
+    Serial2.flush();
+    return true;
   }
-  inline void sleep_goto_dormant_until_edge_low(uint gpio_pin) {
-    sleep_goto_dormant_until_pin(gpio_pin, true, false);
+
+  static bool suspendUSB(void *) {
+    Serial.flush();
+    Serial.end();
+#if defined(USE_TINYUSB)
+    USBDevice.detach();
+#endif
+    return true;
+  }
+
+  static bool resumeUSB(void *) {
+#if defined(USE_TINYUSB)
+    USBDevice.attach();
+#endif
+    Serial.begin(115200);
+    return true;
   }
 };
 
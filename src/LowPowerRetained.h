@@ -0,0 +1,198 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+/**
+ * Declare a RetainedBuffer with LP_RETAINED, so that it keeps its content
+ * while the processor is restarted by a deep sleep: on the ESP32 we use the
+ * RTC slow memory and on the RP2040 the RAM which is not initialized at
+ * startup. On the ESP8266 the content is saved to the RTC user memory
+ * instead.
+ */
+#if defined(ESP32)
+#  define LP_RETAINED RTC_DATA_ATTR
+#elif defined(ARDUINO_ARCH_RP2040)
+#  define LP_RETAINED __attribute__((section(".uninitialized_data")))
+#else
+#  define LP_RETAINED
+#endif
+
+namespace low_power {
+
+/**
+ * @brief Ring buffer for samples which survives a deep sleep: We collect
+ * the samples across multiple sleep cycles and call the flush callback only
+ * when the threshold is reached or the oldest sample is older than the max
+ * age, so that we only need to power the radio once per batch. If the
+ * callback fails (e.g. because there is no connection) we keep the samples
+ * and overwrite the oldest ones when the buffer is full. The content is
+ * validated with a CRC, so that we start with an empty buffer after a power
+ * on.
+ *
+ * The object does not have any constructor which would overwrite the
+ * retained content: call begin() in setup() after each restart. The times
+ * are provided by the caller (e.g. from a RTC or NTP), because the clock
+ * might be reset by a deep sleep.
+ * @author Phil Schatzmann
+ */
+template <typename T, uint16_t N>
+class RetainedBuffer {
+ public:
+  /// Callback which receives the collected samples: returns false if the
+  /// samples could not be processed
+  typedef bool (*flush_callback_t)(const T *data, uint16_t count, void *ref);
+
+  /// Restores the content and defines the flush condition: returns false if
+  /// the content was not valid and the buffer was cleared
+  bool begin(flush_callback_t callback, uint16_t threshold = N,
+             time_us_t max_age_us = 0, void *ref = nullptr) {
+    flush_callback = callback;
+    flush_ref = ref;
+    flush_threshold = threshold == 0 || threshold > N ? N : threshold;
+    flush_max_age_us = max_age_us;
+    load();
+    bool result = isValid();
+    if (!result) clear();
+    return result;
+  }
+
+  /// Adds a sample and flushes the buffer if the threshold or the deadline
+  /// was reached. Returns true if the buffer was flushed.
+  bool add(const T &sample, time_us_t now_us = 0) {
+    if (state.count == N) {
+      // drop the oldest sample
+      state.start = (state.start + 1) % N;
+      state.count--;
+    }
+    if (state.count == 0) state.first_us = now_us;
+    state.data[(state.start + state.count) % N] = sample;
+    state.count++;
+    if (isFlushDue(now_us)) return flush();
+    save();
+    return false;
+  }
+
+  /// Returns true if the threshold or the deadline was reached
+  bool isFlushDue(time_us_t now_us = 0) {
+    if (state.count == 0) return false;
+    if (state.count >= flush_threshold) return true;
+    return flush_max_age_us > 0 &&
+           now_us >= state.first_us + flush_max_age_us;
+  }
+
+  /// Calls the flush callback with all samples in the sequence of their
+  /// arrival and clears the buffer if the callback was successful
+  bool flush() {
+    if (state.count == 0 || flush_callback == nullptr) return false;
+    // rotate the ring, so that we can provide a consecutive array
+    if (state.start > 0) rotate();
+    if (!flush_callback(state.data, state.count, flush_ref)) {
+      save();
+      return false;
+    }
+    clear();
+    return true;
+  }
+
+  /// Provides the sample at the indicated position (0 = oldest)
+  const T &operator[](uint16_t idx) {
+    return state.data[(state.start + idx) % N];
+  }
+
+  /// Number of collected samples
+  uint16_t size() { return state.count; }
+
+  /// Max number of samples
+  uint16_t capacity() { return N; }
+
+  /// Time of the oldest sample
+  time_us_t firstTimeUs() { return state.first_us; }
+
+  /// Removes all samples
+  void clear() {
+    state.magic = magic;
+    state.start = 0;
+    state.count = 0;
+    state.first_us = 0;
+    save();
+  }
+
+  /// Writes the content to the retained memory
+  void save() {
+    state.crc = crc();
+#if defined(ESP8266)
+    ESP.rtcUserMemoryWrite(LOW_POWER_RTC_BUFFER_OFFSET, (uint32_t *)&state,
+                           sizeof(state));
+#endif
+  }
+
+  /// Reads the content from the retained memory
+  void load() {
+#if defined(ESP8266)
+    if (!ESP.rtcUserMemoryRead(LOW_POWER_RTC_BUFFER_OFFSET,
+                               (uint32_t *)&state, sizeof(state)))
+      state.magic = 0;
+#endif
+  }
+
+  /// Returns true if the retained content is consistent
+  bool isValid() {
+    return state.magic == magic && state.count <= N && state.start < N &&
+           state.crc == crc();
+  }
+
+ protected:
+  static const uint32_t magic = 0x4C504246;
+  struct state_t {
+    uint32_t magic;
+    uint16_t start;
+    uint16_t count;
+    time_us_t first_us;
+    uint32_t crc;
+    T data[N];
+  } state;
+#if defined(ESP8266)
+  static_assert(sizeof(state_t) <= (128 - LOW_POWER_RTC_BUFFER_OFFSET) * 4,
+                "RetainedBuffer does not fit into the RTC user memory");
+#endif
+  flush_callback_t flush_callback;
+  void *flush_ref;
+  uint16_t flush_threshold;
+  time_us_t flush_max_age_us;
+
+  /// CRC32 of the header and the used samples
+  uint32_t crc() {
+    uint32_t result = crc32(&state, offsetof(state_t, crc), 0xFFFFFFFF);
+    for (uint16_t j = 0; j < state.count; j++) {
+      result = crc32(&state.data[(state.start + j) % N], sizeof(T), result);
+    }
+    return ~result;
+  }
+
+  static uint32_t crc32(const void *data, size_t len, uint32_t crc) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    for (size_t j = 0; j < len; j++) {
+      crc ^= ptr[j];
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return crc;
+  }
+
+  /// moves the oldest sample to the first position
+  void rotate() {
+    for (uint16_t r = 0; r < state.start; r++) {
+      T first = state.data[0];
+      for (uint16_t j = 1; j < N; j++) state.data[j - 1] = state.data[j];
+      state.data[N - 1] = first;
+    }
+    state.start = 0;
+  }
+};
+
+}  // namespace low_power
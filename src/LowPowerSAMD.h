@@ -5,74 +5,167 @@
 
 namespace low_power {
 
+class ArduinoLowPowerSAMD;
+static ArduinoLowPowerSAMD *selfArduinoLowPowerSAMD = nullptr;
+
+/// set by the pin interrupt to stop a chained sleep
+static volatile bool is_samd_pin_wakeup = false;
+/// EIC interrupt flags at the time of the pin wakeup
+static volatile uint32_t samd_eic_flags = 0;
+/// set by the ADC window interrupt
+static volatile bool is_samd_analog_wakeup = false;
+/// the USB device was detached by the sleep
+static bool is_usb_detached = false;
+
 /**
  * @brief Low Power Management for SAMD.
- * Depends on RTCZero!
+ * - the timed sleeps use the RTC as 32 bit counter with 1024 Hz, so that
+ * we support alarms with a resolution of 1 ms.
+ * - wakeup by pins, by time or by an analog value: the ADC runs in standby
+ * from the 32 kHz low power oscillator and the window comparator only
+ * wakes up the processor when the condition is met.
  * @author Phil Schatzmann
  *
  */
 
-class ArduinoLowPowerSAMD : public ArduinoLowPowerCommon {
+class ArduinoLowPowerSAMD : public LP_COMMON(ArduinoLowPowerSAMD) {
  public:
-  bool setSleepMode(sleep_mode_enum_t sleep_mode) {
-    bool result = false;
-    switch (sleep_mode) {
-      case sleep_mode_enum_t::modemSleep:
-        result = true;
-        break;
-      case sleep_mode_enum_t::noSleep:
-        result = true;
-        break;
-      case sleep_mode_enum_t::lightSleep:
-        result = false;
-        break;
-      case sleep_mode_enum_t::deepSleep:
-        result = false;
-        break;
-    }
-    return result;
+  ArduinoLowPowerSAMD() {
+    selfArduinoLowPowerSAMD = this;
+#if LOW_POWER_PERIPHERALS
+    addUSBPeripheral();
+#endif
   }
 
   /// sets processor into sleep mode
-  bool sleep(void) override {
+  bool sleep(void) LP_OVERRIDE {
     bool rc = false;
+    bool is_standby = sleep_mode == sleep_mode_enum_t::lightSleep ||
+                      sleep_mode == sleep_mode_enum_t::deepSleep;
+    beginSleep();
+#if !LOW_POWER_PERIPHERALS
+    // w/o the peripheral registry we handle the USB device directly
+    if (is_standby) suspendUSB(nullptr);
+#endif
+    enterSleep();
+    is_samd_pin_wakeup = false;
+    is_samd_analog_wakeup = false;
+    samd_eic_flags = 0;
+    if (analog_pin >= 0) samd.rearmAdcInterrupt();
+    // millis() stops in standby: we measure the sleep with the RTC
+    uint32_t start_ticks = is_standby ? samd.rtcTicks() : 0;
     switch (sleep_mode) {
       case sleep_mode_enum_t::lightSleep:
-        samd.sleep(sleep_time_us / 1000);
+        if (sleep_time_us == 0) {
+          samd.sleep();
+        } else {
+          // the alarm is defined in 32 bit ms
+          sleepChained(sleep_time_us, max_alarm_us, [this](time_us_t us) {
+            samd.sleep((uint32_t)(us / 1000));
+            return !is_samd_pin_wakeup && !is_samd_analog_wakeup;
+          });
+        }
         rc = true;
         break;
 
       case sleep_mode_enum_t::deepSleep:
-        samd.deepSleep(sleep_time_us / 1000);
+        if (sleep_time_us == 0) {
+          samd.deepSleep();
+        } else {
+          sleepChained(sleep_time_us, max_alarm_us, [this](time_us_t us) {
+            samd.deepSleep((uint32_t)(us / 1000));
+            return !is_samd_pin_wakeup && !is_samd_analog_wakeup;
+          });
+        }
         rc = true;
         break;
 
       case sleep_mode_enum_t::modemSleep:
       case sleep_mode_enum_t::noSleep:
-        delay(sleep_time_us / 1000);
+        delayUs(sleep_time_us);
         rc = true;
         break;
     }
+    time_us_t slept_us =
+        is_standby ? (time_us_t)(samd.rtcTicks() - start_ticks) * 1000000 / 1024
+                   : 0;
+    exitSleep(detectWakeupCause(), slept_us, detectWakeupPin());
+#if !LOW_POWER_PERIPHERALS
+    if (is_standby) resumeUSB(nullptr);
+#endif
+    endSleep();
 
     return rc;
   }
 
-  bool setSleepTime(uint32_t time, time_unit_t time_unit_type) override {
+  bool setSleepTime(uint64_t time, time_unit_t time_unit_type) LP_OVERRIDE {
     sleep_time_us = (toUs(time, time_unit_type));
     return true;
   }
 
-  bool addWakeupPin(int pin, pin_change_t change_type) override {
+  bool addWakeupPin(int pin, pin_change_t change_type) LP_OVERRIDE {
+    if (pin_count >= max_pins) return false;
     samd.attachInterruptWakeup(pin, callback, toMode(change_type));
+    pins[pin_count++] = pin;
     return true;
   }
 
+  /// The ADC compares each (averaged) 12 bit sample with the window: low
+  /// and high are in the range 0 - 4095
+  bool addWakeupAnalog(int pin, analog_window_t window, uint16_t low,
+                       uint16_t high) LP_OVERRIDE {
+    samd.attachAdcInterrupt(pin, analogCallback, toAdcInterrupt(window), low,
+                            high);
+    analog_pin = pin;
+    return true;
+  }
+
+  /// Defines the sample rate and the number of averaged samples (1, 2, 4, 8
+  /// or 16) of the ADC for addWakeupAnalog(): call it before
+  /// addWakeupAnalog(). The ADC is clocked by the 32 kHz low power
+  /// oscillator, so we support about 2 Hz to 1 kHz. Returns false if the
+  /// values are not supported.
+  bool setAnalogSampling(uint32_t rate_hz, uint16_t averaging = 1) {
+    uint8_t samplenum = 0;
+    while ((1u << samplenum) < averaging && samplenum < 4) samplenum++;
+    if (rate_hz == 0 || (1u << samplenum) != averaging) return false;
+    // a 12 bit conversion needs 7 ADC clocks and the sampling time of
+    // (samplen + 1) / 2 clocks: we use the slowest possible ADC clock
+    for (int prescaler = 7; prescaler >= 0; prescaler--) {
+      uint32_t adc_hz = 32768 >> (prescaler + 2);
+      uint32_t cycles = adc_hz / (rate_hz * averaging);
+      if (cycles >= 7 || prescaler == 0) {
+        uint32_t samplen = cycles > 7 ? (cycles - 7) * 2 - 1 : 0;
+        samd.setAdcSampling(prescaler, samplen > 63 ? 63 : samplen,
+                            samplenum);
+        return cycles >= 7;
+      }
+    }
+    return false;
+  }
+
   void clear() {
     ArduinoLowPowerCommon::clear();
     samd.detachAdcInterrupt();
-    sleep_time_us = 0;
+    pin_count = 0;
+    analog_pin = -1;
+#if LOW_POWER_PERIPHERALS
+    // the registered peripherals are kept: we only restore the default
+    addUSBPeripheral();
+#endif
   }
   
+  /// light and deep sleep are both using the standby mode
+  sleep_mode_cost_t getSleepModeCost(sleep_mode_enum_t mode) LP_OVERRIDE {
+    switch (mode) {
+      case sleep_mode_enum_t::lightSleep:
+      case sleep_mode_enum_t::deepSleep:
+        return {50, 500, false, 33, 0};
+      default:
+        return {0, 0, false, 19800, 0};
+    }
+  }
+
   bool isProcessingOnSleep(sleep_mode_enum_t sleep_mode) {
     bool result = false;
     switch (sleep_mode) {
@@ -92,10 +185,96 @@ class ArduinoLowPowerSAMD : public ArduinoLowPowerCommon {
     return result;
   }
  protected:
-  uint32_t sleep_time_us = 0;
   ArduinoLowPowerClass samd;
+  /// the RTC counter supports about 48 days with 1024 Hz
+  const time_us_t max_alarm_us = 4000000000ull * 1000;
+  static const int max_pins = 16;
+  uint8_t pins[max_pins];
+  int pin_count = 0;
+  int analog_pin = -1;
+
+  /// the EIC flags are cleared after the callback
+  static void callback() {
+    uint32_t flags = EIC->INTFLAG.reg;
+    is_samd_pin_wakeup = true;
+    samd_eic_flags |= flags;
+    ArduinoLowPowerSAMD *self = selfArduinoLowPowerSAMD;
+    if (self == nullptr) return;
+    // the core calls the callbacks in the sequence of attachInterrupt() and
+    // clears the flag afterwards: so we serve the first pending pin
+    for (int j = 0; j < self->pin_count; j++) {
+      int pin = self->pins[j];
+      if (flags & (1ul << g_APinDescription[pin].ulExtInt)) {
+        self->wake_events.push(wakeup_cause_t::pin, pin, digitalRead(pin));
+        return;
+      }
+    }
+  }
+
+#if LOW_POWER_PERIPHERALS
+  /// The USB device is suspended last and resumed first: remove the "usb"
+  /// peripheral to keep the USB connection
+  void addUSBPeripheral() {
+    peripheral_registry.add("usb", suspendUSB, resumeUSB, nullptr, 100);
+  }
+#endif
+
+  /// a virtual serial port needs the standby mode, otherwise we detach
+  static bool suspendUSB(void *) {
+    if (SERIAL_PORT_USBVIRTUAL) {
+      USBDevice.standby();
+      is_usb_detached = false;
+    } else {
+      USBDevice.detach();
+      is_usb_detached = true;
+    }
+    return true;
+  }
 
-  static void callback() {}
+  static bool resumeUSB(void *) {
+    if (is_usb_detached) USBDevice.attach();
+    is_usb_detached = false;
+    return true;
+  }
+
+  static void analogCallback() {
+    is_samd_analog_wakeup = true;
+    ArduinoLowPowerSAMD *self = selfArduinoLowPowerSAMD;
+    if (self != nullptr)
+      self->wake_events.push(wakeup_cause_t::analog, self->analog_pin, 0);
+  }
+
+  /// Determines the wakeup cause of the last sleep
+  wakeup_cause_t detectWakeupCause() {
+    if (is_samd_pin_wakeup) return wakeup_cause_t::pin;
+    if (is_samd_analog_wakeup) return wakeup_cause_t::analog;
+    return sleep_time_us > 0 ? wakeup_cause_t::timer
+                             : wakeup_cause_t::undefined;
+  }
+
+  /// Determines the registered pin from the EIC flags
+  int detectWakeupPin() {
+    if (is_samd_analog_wakeup) return analog_pin;
+    if (!is_samd_pin_wakeup) return -1;
+    for (int j = 0; j < pin_count; j++) {
+      if (samd_eic_flags & (1ul << g_APinDescription[pins[j]].ulExtInt))
+        return pins[j];
+    }
+    return -1;
+  }
+
+  adc_interrupt toAdcInterrupt(analog_window_t window) {
+    switch (window) {
+      case analog_window_t::between:
+        return ADC_INT_BETWEEN;
+      case analog_window_t::outside:
+        return ADC_INT_OUTSIDE;
+      case analog_window_t::above:
+        return ADC_INT_ABOVE_MIN;
+      default:
+        return ADC_INT_BELOW_MAX;
+    }
+  }
 
   PinStatus toMode(pin_change_t ct) {
     switch (ct) {
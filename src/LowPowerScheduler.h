@@ -0,0 +1,128 @@
+#pragma once
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+namespace low_power {
+
+/// Callback of a scheduled job
+typedef void (*job_callback_t)(void *ref);
+
+/**
+ * @brief Tickless scheduler for periodic jobs: each job has a period and a
+ * slack window by which its execution may be delayed. We wake up at the
+ * earliest end of all slack windows and execute all jobs which are due at
+ * this time, so that deadlines that fall into the slack windows are merged
+ * into a single wakeup. The job deadlines keep their phase, so that the
+ * periods do not drift.
+ *
+ * Use LowPower.setScheduler(scheduler) so that process() executes the jobs
+ * and sleeps until the next wakeup.
+ * @author Phil Schatzmann
+ */
+class LowPowerScheduler {
+ public:
+  /// Registers a job: a period of 0 executes the job only once. Returns the
+  /// job id or -1 if there is no free slot.
+  int addJob(job_callback_t callback, time_us_t period_us,
+             time_us_t slack_us = 0, void *ref = nullptr,
+             time_us_t first_us = 0) {
+    for (int j = 0; j < LOW_POWER_MAX_JOBS; j++) {
+      if (jobs[j].callback == nullptr) {
+        jobs[j].callback = callback;
+        jobs[j].ref = ref;
+        jobs[j].period_us = period_us;
+        jobs[j].slack_us = slack_us;
+        jobs[j].next_us = first_us > 0 ? first_us : period_us;
+        jobs[j].is_relative = first_us == 0;
+        return j;
+      }
+    }
+    return -1;
+  }
+
+  /// Removes the job with the indicated id
+  bool removeJob(int id) {
+    if (id < 0 || id >= LOW_POWER_MAX_JOBS) return false;
+    jobs[id].callback = nullptr;
+    return true;
+  }
+
+  /// Executes all jobs which are due and returns the number of executed jobs
+  int run(time_us_t now_us) {
+    int result = 0;
+    for (int j = 0; j < LOW_POWER_MAX_JOBS; j++) {
+      Job &job = jobs[j];
+      if (job.callback == nullptr) continue;
+      // the first deadline is relative to the first run
+      if (job.is_relative) {
+        job.next_us += now_us;
+        job.is_relative = false;
+      }
+      if (job.next_us > now_us) continue;
+      job_callback_t callback = job.callback;
+      if (job.period_us == 0) {
+        job.callback = nullptr;
+      } else {
+        // keep the phase: skip missed periods
+        while (job.next_us <= now_us) job.next_us += job.period_us;
+      }
+      callback(job.ref);
+      executions++;
+      result++;
+    }
+    if (result > 0) runs++;
+    return result;
+  }
+
+  /// Provides the latest time at which we need to wake up: this is the
+  /// earliest end of the slack windows of all jobs. Returns 0 if there are
+  /// no jobs.
+  time_us_t nextWakeupUs() {
+    time_us_t result = 0;
+    for (int j = 0; j < LOW_POWER_MAX_JOBS; j++) {
+      Job &job = jobs[j];
+      if (job.callback == nullptr || job.is_relative) continue;
+      time_us_t end_us = job.next_us + job.slack_us;
+      if (result == 0 || end_us < result) result = end_us;
+    }
+    return result;
+  }
+
+  /// Number of registered jobs
+  int jobCount() {
+    int result = 0;
+    for (int j = 0; j < LOW_POWER_MAX_JOBS; j++) {
+      if (jobs[j].callback != nullptr) result++;
+    }
+    return result;
+  }
+
+  /// Number of runs which executed at least one job (= wakeups)
+  uint32_t runCount() { return runs; }
+
+  /// Total number of job executions
+  uint32_t executionCount() { return executions; }
+
+  /// Removes all jobs
+  void clear() {
+    for (int j = 0; j < LOW_POWER_MAX_JOBS; j++) jobs[j].callback = nullptr;
+    runs = 0;
+    executions = 0;
+  }
+
+ protected:
+  struct Job {
+    job_callback_t callback = nullptr;
+    void *ref = nullptr;
+    time_us_t period_us = 0;
+    time_us_t slack_us = 0;
+    time_us_t next_us = 0;
+    bool is_relative = false;
+  };
+  Job jobs[LOW_POWER_MAX_JOBS];
+  uint32_t runs = 0;
+  uint32_t executions = 0;
+};
+
+}  // namespace low_power
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+namespace low_power {
+
+/**
+ * @brief Sleep statistics: the latencies are recorded in histograms with
+ * log2 buckets: bucket 0 counts 0 us, bucket n counts values from 2^(n-1) to
+ * 2^n - 1 us. The last bucket also contains all bigger values.
+ */
+struct sleep_statistics_t {
+  /// number of sleep() calls which entered a sleep
+  uint32_t sleep_count;
+  /// cumulative time in us per sleep_mode_enum_t
+  uint64_t residency_us[sleep_mode_count];
+  /// number of wakeups per wakeup_cause_t
+  uint32_t wakeup_count[wakeup_cause_count];
+  /// latency from sleep() to the hardware sleep
+  uint32_t entry_latency[LOW_POWER_HISTOGRAM_BUCKETS];
+  /// latency from the hardware wakeup to the return of sleep()
+  uint32_t wakeup_latency[LOW_POWER_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @brief Records the time spent in the different sleep modes and the
+ * sleep entry and wakeup latencies. Each transition only costs a time
+ * difference and a few increments. The times are provided by the 64 bit
+ * monotonic clock (nowUs()), so that long sleeps do not wrap.
+ * @author Phil Schatzmann
+ */
+class LowPowerStatistics {
+ public:
+  LowPowerStatistics() { clear(); }
+
+  /// Start of the sleep() processing
+  void begin(time_us_t now_us) { begin_us = now_us; }
+
+  /// We are about to enter the hardware sleep
+  void enter(sleep_mode_enum_t mode, time_us_t now_us) {
+    sleep_mode_idx = (uint8_t)mode;
+    enter_us = now_us;
+    stats.sleep_count++;
+    stats.entry_latency[bucket(latency(begin_us, now_us))]++;
+  }
+
+  /// We have been woken up: the slept time is determined from the time
+  /// difference if it is not provided
+  void exit(wakeup_cause_t cause, time_us_t now_us, time_us_t slept_us = 0) {
+    exit_us = now_us;
+    stats.residency_us[sleep_mode_idx] +=
+        slept_us > 0 ? slept_us : (now_us - enter_us);
+    stats.wakeup_count[(uint8_t)cause]++;
+  }
+
+  /// sleep() is returning
+  void end(time_us_t now_us) {
+    stats.wakeup_latency[bucket(latency(exit_us, now_us))]++;
+  }
+
+  /// Provides the recorded statistics
+  const sleep_statistics_t &get() const { return stats; }
+
+  /// Total time in all sleep modes
+  uint64_t totalSleepUs() const {
+    uint64_t result = 0;
+    for (int j = 1; j < sleep_mode_count; j++) result += stats.residency_us[j];
+    return result;
+  }
+
+  /// Resets all counters
+  void clear() { memset(&stats, 0, sizeof(stats)); }
+
+  /// Determines the histogram bucket for the indicated latency
+  static uint8_t bucket(uint32_t us) {
+    if (us == 0) return 0;
+    uint8_t idx = sizeof(unsigned long) * 8 - __builtin_clzl(us);
+    return idx < LOW_POWER_HISTOGRAM_BUCKETS ? idx
+                                             : LOW_POWER_HISTOGRAM_BUCKETS - 1;
+  }
+
+  /// Provides the lower limit in us of the indicated bucket
+  static uint32_t bucketMinUs(uint8_t idx) {
+    return idx == 0 ? 0 : 1ul << (idx - 1);
+  }
+
+ protected:
+  sleep_statistics_t stats;
+  time_us_t begin_us = 0;
+  time_us_t enter_us = 0;
+  time_us_t exit_us = 0;
+  uint8_t sleep_mode_idx = 0;
+
+  /// time difference which is limited to 32 bits for the histograms
+  static uint32_t latency(time_us_t from_us, time_us_t to_us) {
+    time_us_t result = to_us > from_us ? to_us - from_us : 0;
+    return result > 0xFFFFFFFFul ? 0xFFFFFFFFul : (uint32_t)result;
+  }
+};
+
+}  // namespace low_power
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace low_power {
+
+/// Date and time in UTC: the fields have the same layout as the RP2040
+/// datetime_t
+struct civil_time_t {
+  /// e.g. 2024
+  int16_t year;
+  /// 1 - 12
+  int8_t month;
+  /// 1 - 31
+  int8_t day;
+  /// day of the week: 0 = sunday
+  int8_t dotw;
+  /// 0 - 23
+  int8_t hour;
+  /// 0 - 59
+  int8_t min;
+  /// 0 - 59
+  int8_t sec;
+};
+
+/// Days since 1970-01-01 for the indicated date (month 1 - 12) of the
+/// proleptic gregorian calendar: the calendar is split into eras of 400
+/// years with years that start in March, so that the leap day is the last
+/// day. This avoids any loops, tables and the timezone handling of mktime()
+/// and localtime(). See http://howardhinnant.github.io/date_algorithms.html
+inline int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day) {
+  year -= month <= 2;
+  const int32_t era = (year >= 0 ? year : year - 399) / 400;
+  const uint32_t yoe = (uint32_t)(year - era * 400);
+  const uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 +
+                       day - 1;
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+/// Day of the week (0 = sunday) for the days since 1970-01-01 (a thursday)
+inline int8_t weekdayFromDays(int32_t days) {
+  return (int8_t)(days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6);
+}
+
+/// Determines the year, month, day and day of the week from the days since
+/// 1970-01-01: the time fields are not changed
+inline void civilFromDays(int32_t days, civil_time_t &result) {
+  days += 719468;
+  const int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const uint32_t doe = (uint32_t)(days - era * 146097);
+  const uint32_t yoe =
+      (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const uint32_t mp = (5 * doy + 2) / 153;
+  const uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+  result.year = (int16_t)((int32_t)yoe + era * 400 + (month <= 2));
+  result.month = (int8_t)month;
+  result.day = (int8_t)(doy - (153 * mp + 2) / 5 + 1);
+  result.dotw = weekdayFromDays(days - 719468);
+}
+
+/// Seconds since 1970-01-01 00:00:00 UTC
+inline int64_t civilToEpoch(const civil_time_t &time) {
+  int32_t days = daysFromCivil(time.year, time.month, time.day);
+  return (int64_t)days * 86400 +
+         (int32_t)(time.hour * 3600 + time.min * 60 + time.sec);
+}
+
+/// Converts the seconds since 1970-01-01 00:00:00 UTC: only 32 bit
+/// divisions are used (86400 = 128 * 675)
+inline civil_time_t &epochToCivil(int64_t epoch, civil_time_t &result) {
+  int32_t q = (int32_t)(epoch >> 7);
+  int32_t days = (q >= 0 ? q : q - 674) / 675;
+  uint32_t sod = (uint32_t)(epoch - (int64_t)days * 86400);
+  civilFromDays(days, result);
+  result.hour = (int8_t)(sod / 3600);
+  sod -= (uint32_t)result.hour * 3600;
+  result.min = (int8_t)(sod / 60);
+  result.sec = (int8_t)(sod - (uint32_t)result.min * 60);
+  return result;
+}
+
+}  // namespace low_power
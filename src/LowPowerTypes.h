@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace low_power {
+
+/// Time in microseconds
+typedef uint64_t time_us_t;
+/// Max time: used for an unknown or unlimited time
+const time_us_t time_us_max = 0xFFFFFFFFFFFFFFFFull;
+
+enum class sleep_mode_enum_t {
+  noSleep,
+  lightSleep,
+  deepSleep,
+  modemSleep,
+};
+
+enum class time_unit_t {
+  sec,
+  ms,
+  us,
+};
+
+enum class pin_change_t {
+  on_high,
+  on_low,
+};
+
+/// Condition of an analog value which wakes up the processor
+enum class analog_window_t {
+  /// low <= value <= high
+  between,
+  /// value < low or value > high
+  outside,
+  /// value > low
+  above,
+  /// value < high
+  below,
+};
+
+/// Source which caused the wakeup
+enum class wakeup_cause_t {
+  undefined,
+  timer,
+  pin,
+  touch,
+  analog,
+  other,
+};
+
+/// Information about the last wakeup
+struct wakeup_info_t {
+  /// source which caused the wakeup
+  wakeup_cause_t cause;
+  /// pin which caused the wakeup or -1
+  int pin;
+  /// time of the wakeup (nowUs())
+  time_us_t time_us;
+  /// true if the wakeup restarted the processor in setup()
+  bool is_restart;
+};
+
+/// Wakeup event which was recorded by an interrupt
+struct wake_event_t {
+  /// source of the event
+  wakeup_cause_t source;
+  /// pin which caused the event or -1
+  int8_t pin;
+  /// level of the pin after the change
+  uint8_t level;
+  /// micros() at the time of the interrupt
+  uint32_t time_us;
+};
+
+/// Costs of a sleep mode
+struct sleep_mode_cost_t {
+  /// time needed to enter the sleep mode
+  uint32_t entry_us;
+  /// time needed after the wakeup until we can process again
+  uint32_t exit_us;
+  /// true if the wakeup restarts the processor in setup()
+  bool is_restart;
+  /// power consumption in the sleep mode (noSleep: active power) in uW
+  uint32_t power_uw;
+  /// additional energy needed for the transition (e.g. restart) in uJ
+  uint32_t transition_uj;
+};
+
+/// Number of sleep modes
+const int sleep_mode_count = 4;
+/// Number of wakeup causes
+const int wakeup_cause_count = 6;
+
+}  // namespace low_power
@@ -0,0 +1,489 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "LowPowerConfig.h"
+#include "LowPowerTypes.h"
+
+/// The ULP FSM coprocessor is available on the ESP32
+#if defined(ESP32) && CONFIG_IDF_TARGET_ESP32
+#  include "driver/rtc_io.h"
+#  include "esp_idf_version.h"
+#  include "soc/rtc_cntl_reg.h"
+#  include "soc/rtc_io_reg.h"
+#  if ESP_IDF_VERSION_MAJOR >= 5
+#    include "ulp.h"
+#    include "ulp_adc.h"
+#  else
+#    include "driver/adc.h"
+#    include "esp32/ulp.h"
+#  endif
+#  define LOW_POWER_ULP_FSM 1
+#else
+#  define LOW_POWER_ULP_FSM 0
+#endif
+
+namespace low_power {
+
+/// Instructions of an UlpProgram: they correspond to the instructions of
+/// the ESP32 ULP FSM (the conditional jumps compare R0 with a value)
+enum class ulp_opcode_t : uint8_t {
+  movi,     ///< rd = imm
+  movr,     ///< rd = rs
+  addi,     ///< rd = rs + imm
+  addr,     ///< rd = rs + rt
+  subr,     ///< rd = rs - rt
+  ld,       ///< rd = data[rs + imm]
+  st,       ///< data[rt + imm] = rs
+  adc,      ///< rd = adc channel imm
+  gpio,     ///< rd = level of gpio imm
+  label,    ///< jump target rd
+  jump,     ///< jump to label rd
+  jump_lt,  ///< jump to label rd if R0 < imm
+  jump_ge,  ///< jump to label rd if R0 >= imm
+  wake,     ///< wake up the main processor (waits until the SoC is ready:
+            ///< R0 is overwritten)
+  halt,     ///< stop until the next period
+};
+
+/// Single instruction of an UlpProgram
+struct ulp_op_t {
+  ulp_opcode_t op;
+  uint8_t rd;
+  uint8_t rs;
+  uint8_t rt;
+  uint16_t imm;
+};
+
+/// Sensor which is sampled by the threshold monitor
+enum class ulp_source_t { adc, gpio };
+
+/// Condition of the threshold monitor
+enum class ulp_window_t {
+  /// the value is below the low or above the high threshold
+  outside,
+  /// the value is between the low and high threshold
+  inside,
+};
+
+/**
+ * @brief Small program for the ULP coprocessor which runs periodically
+ * during the deep sleep: e.g. it samples an ADC channel or a gpio and only
+ * wakes up the main processor when a condition is met. The same program can
+ * be executed on the desktop with the UlpInterpreter, so that the logic can
+ * be tested without hardware.
+ *
+ * On the ESP32 the program is translated to ULP FSM instructions and loaded
+ * after the LOW_POWER_ULP_DATA_WORDS data words into the RTC slow memory.
+ * @author Phil Schatzmann
+ */
+class UlpProgram {
+ public:
+  /// data word with the number of consecutive matches (thresholdMonitor)
+  static const int counter_idx = 0;
+  /// data word with the last sampled value (thresholdMonitor)
+  static const int value_idx = 1;
+
+  /// Defines a program which samples the source and wakes up the main
+  /// processor after count consecutive samples that meet the window
+  /// condition for the low and high threshold. The channel is the ADC1
+  /// channel or the gpio number.
+  bool thresholdMonitor(ulp_source_t source, uint8_t channel, uint16_t low,
+                        uint16_t high, uint16_t count = 1,
+                        ulp_window_t window = ulp_window_t::outside) {
+    const uint8_t match = 0, no_match = 1, wakeup = 2;
+    uint8_t outside = window == ulp_window_t::outside ? match : no_match;
+    uint8_t inside = window == ulp_window_t::outside ? no_match : match;
+    bool ok = true;
+    clear();
+    // R2 is the address of the data
+    ok = ok && movi(2, 0);
+    ok = ok && (source == ulp_source_t::adc ? adc(0, channel)
+                                            : gpio(0, channel));
+    ok = ok && st(0, 2, value_idx);
+    ok = ok && jumpLt(outside, low);
+    if (high < 0xFFFF) ok = ok && jumpGe(outside, high + 1);
+    ok = ok && jump(inside);
+    // count the consecutive matches
+    ok = ok && label(match);
+    ok = ok && ld(1, 2, counter_idx);
+    ok = ok && addi(1, 1, 1);
+    ok = ok && st(1, 2, counter_idx);
+    ok = ok && movr(0, 1);
+    ok = ok && jumpGe(wakeup, count);
+    ok = ok && halt();
+    ok = ok && label(no_match);
+    ok = ok && movi(1, 0);
+    ok = ok && st(1, 2, counter_idx);
+    ok = ok && halt();
+    ok = ok && label(wakeup);
+    ok = ok && movi(1, 0);
+    ok = ok && st(1, 2, counter_idx);
+    ok = ok && wake();
+    ok = ok && halt();
+    return ok;
+  }
+
+  bool movi(uint8_t rd, uint16_t imm) {
+    return add({ulp_opcode_t::movi, rd, 0, 0, imm});
+  }
+  bool movr(uint8_t rd, uint8_t rs) {
+    return add({ulp_opcode_t::movr, rd, rs, 0, 0});
+  }
+  bool addi(uint8_t rd, uint8_t rs, uint16_t imm) {
+    return add({ulp_opcode_t::addi, rd, rs, 0, imm});
+  }
+  bool addr(uint8_t rd, uint8_t rs, uint8_t rt) {
+    return add({ulp_opcode_t::addr, rd, rs, rt, 0});
+  }
+  bool subr(uint8_t rd, uint8_t rs, uint8_t rt) {
+    return add({ulp_opcode_t::subr, rd, rs, rt, 0});
+  }
+  bool ld(uint8_t rd, uint8_t rs_addr, uint16_t offset) {
+    return add({ulp_opcode_t::ld, rd, rs_addr, 0, offset});
+  }
+  bool st(uint8_t rs, uint8_t rt_addr, uint16_t offset) {
+    return add({ulp_opcode_t::st, 0, rs, rt_addr, offset});
+  }
+  bool adc(uint8_t rd, uint8_t channel) {
+    return add({ulp_opcode_t::adc, rd, 0, 0, channel});
+  }
+  bool gpio(uint8_t rd, uint8_t pin) {
+    return add({ulp_opcode_t::gpio, rd, 0, 0, pin});
+  }
+  bool label(uint8_t id) { return add({ulp_opcode_t::label, id, 0, 0, 0}); }
+  bool jump(uint8_t id) { return add({ulp_opcode_t::jump, id, 0, 0, 0}); }
+  bool jumpLt(uint8_t id, uint16_t value) {
+    return add({ulp_opcode_t::jump_lt, id, 0, 0, value});
+  }
+  bool jumpGe(uint8_t id, uint16_t value) {
+    return add({ulp_opcode_t::jump_ge, id, 0, 0, value});
+  }
+  bool wake() { return add({ulp_opcode_t::wake, 0, 0, 0, 0}); }
+  bool halt() { return add({ulp_opcode_t::halt, 0, 0, 0, 0}); }
+
+  /// Removes all instructions
+  void clear() { op_count = 0; }
+
+  /// Number of instructions
+  int size() const { return op_count; }
+
+  const ulp_op_t &operator[](int idx) const { return ops[idx]; }
+
+  /// Position of the label or -1
+  int labelIdx(uint8_t id) const {
+    for (int j = 0; j < op_count; j++) {
+      if (ops[j].op == ulp_opcode_t::label && ops[j].rd == id) return j;
+    }
+    return -1;
+  }
+
+#if LOW_POWER_ULP_FSM
+  /// Translates the program, loads it into the RTC slow memory and starts
+  /// it with the indicated period
+  bool start(uint32_t period_us) {
+    // an instruction is translated to at most 3 ULP instructions
+    ulp_insn_t insns[LOW_POWER_ULP_MAX_OPS * 3];
+    size_t size = 0;
+    for (int j = 0; j < op_count; j++) {
+      if (!translate(ops[j], insns, size)) return false;
+    }
+    for (int j = 0; j < LOW_POWER_ULP_DATA_WORDS; j++) RTC_SLOW_MEM[j] = 0;
+    if (ulp_process_macros_and_load(LOW_POWER_ULP_DATA_WORDS, insns,
+                                    &size) != ESP_OK)
+      return false;
+    if (ulp_set_wakeup_period(0, period_us) != ESP_OK) return false;
+    return ulp_run(LOW_POWER_ULP_DATA_WORDS) == ESP_OK;
+  }
+
+  /// Provides a data word which was written by the running program
+  static uint16_t data(int idx) { return RTC_SLOW_MEM[idx] & 0xFFFF; }
+#endif
+
+ protected:
+  ulp_op_t ops[LOW_POWER_ULP_MAX_OPS];
+  int op_count = 0;
+
+  bool add(ulp_op_t op) {
+    if (op_count >= LOW_POWER_ULP_MAX_OPS) return false;
+    // the ULP has 4 registers
+    if (op.op != ulp_opcode_t::label && op.op < ulp_opcode_t::jump &&
+        (op.rd > 3 || op.rs > 3 || op.rt > 3))
+      return false;
+    ops[op_count++] = op;
+    return true;
+  }
+
+#if LOW_POWER_ULP_FSM
+/// appends the instructions which are generated by the ULP macros
+#  define LP_ULP_EMIT(...)                                   \
+    {                                                        \
+      const ulp_insn_t emit[] = {__VA_ARGS__};               \
+      for (const ulp_insn_t &insn : emit) out[size++] = insn; \
+    }
+
+  /// converts an instruction to the ULP FSM macros
+  bool translate(const ulp_op_t &op, ulp_insn_t *out, size_t &size) {
+    switch (op.op) {
+      case ulp_opcode_t::movi:
+        LP_ULP_EMIT(I_MOVI(op.rd, op.imm));
+        return true;
+      case ulp_opcode_t::movr:
+        LP_ULP_EMIT(I_MOVR(op.rd, op.rs));
+        return true;
+      case ulp_opcode_t::addi:
+        LP_ULP_EMIT(I_ADDI(op.rd, op.rs, op.imm));
+        return true;
+      case ulp_opcode_t::addr:
+        LP_ULP_EMIT(I_ADDR(op.rd, op.rs, op.rt));
+        return true;
+      case ulp_opcode_t::subr:
+        LP_ULP_EMIT(I_SUBR(op.rd, op.rs, op.rt));
+        return true;
+      case ulp_opcode_t::ld:
+        LP_ULP_EMIT(I_LD(op.rd, op.rs, op.imm));
+        return true;
+      case ulp_opcode_t::st:
+        LP_ULP_EMIT(I_ST(op.rs, op.rt, op.imm));
+        return true;
+      case ulp_opcode_t::adc:
+        if (!setupAdc(op.imm)) return false;
+        LP_ULP_EMIT(I_ADC(op.rd, 0, op.imm));
+        return true;
+      case ulp_opcode_t::gpio: {
+        int rtc_io = setupGpio(op.imm);
+        if (rtc_io < 0) return false;
+        // reading a register always writes R0
+        LP_ULP_EMIT(I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + rtc_io,
+                             RTC_GPIO_IN_NEXT_S + rtc_io));
+        if (op.rd != 0) LP_ULP_EMIT(I_MOVR(op.rd, 0));
+        return true;
+      }
+      case ulp_opcode_t::label:
+        LP_ULP_EMIT(M_LABEL(op.rd));
+        return true;
+      case ulp_opcode_t::jump:
+        LP_ULP_EMIT(M_BX(op.rd));
+        return true;
+      case ulp_opcode_t::jump_lt:
+        LP_ULP_EMIT(M_BL(op.rd, op.imm));
+        return true;
+      case ulp_opcode_t::jump_ge:
+        LP_ULP_EMIT(M_BGE(op.rd, op.imm));
+        return true;
+      case ulp_opcode_t::wake:
+        // a wakeup is lost if the SoC is not ready for it: so we poll the
+        // ready flag like the ESP-IDF examples (R0 < 1 jumps back 1)
+        LP_ULP_EMIT(I_RD_REG(RTC_CNTL_LOW_POWER_ST_REG,
+                             RTC_CNTL_RDY_FOR_WAKEUP_S,
+                             RTC_CNTL_RDY_FOR_WAKEUP_S),
+                    I_BL(-1, 1), I_WAKE());
+        return true;
+      case ulp_opcode_t::halt:
+        LP_ULP_EMIT(I_HALT());
+        return true;
+    }
+    return false;
+  }
+#  undef LP_ULP_EMIT
+
+  /// the ULP can only use ADC1
+  bool setupAdc(uint8_t channel) {
+#  if ESP_IDF_VERSION_MAJOR >= 5
+    ulp_adc_cfg_t cfg = {};
+    cfg.adc_n = ADC_UNIT_1;
+    cfg.channel = (adc_channel_t)channel;
+    cfg.width = ADC_BITWIDTH_DEFAULT;
+    cfg.atten = ADC_ATTEN_DB_12;
+    cfg.ulp_mode = ADC_ULP_MODE_FSM;
+    return ulp_adc_init(&cfg) == ESP_OK;
+#  else
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten((adc1_channel_t)channel, ADC_ATTEN_DB_11);
+    adc1_ulp_enable();
+    return true;
+#  endif
+  }
+
+  /// the gpio must be a RTC gpio: returns the RTC io number or -1
+  int setupGpio(uint8_t pin) {
+    gpio_num_t gpio = (gpio_num_t)pin;
+    if (!rtc_gpio_is_valid_gpio(gpio)) return -1;
+    rtc_gpio_init(gpio);
+    rtc_gpio_set_direction(gpio, RTC_GPIO_MODE_INPUT_ONLY);
+    return rtc_io_number_get(gpio);
+  }
+#endif
+};
+
+/// Result of an UlpInterpreter run
+struct ulp_result_t {
+  /// the program requested the wakeup of the main processor
+  bool is_wakeup;
+  /// the program was stopped because of an invalid jump, memory access or
+  /// because it did not halt within the max steps
+  bool is_error;
+  /// number of executed instructions
+  uint32_t steps;
+  /// estimated number of ULP clock cycles
+  uint32_t cycles;
+};
+
+/**
+ * @brief Executes an UlpProgram on the desktop (e.g. Linux) with the
+ * semantics of the ESP32 ULP FSM: 4 registers and data words of 16 bits. The
+ * ADC and gpio values are provided by a callback, so that the thresholds can
+ * be tested with recorded or simulated sensor data. The data words are kept
+ * between the runs like the RTC memory in the deep sleep.
+ * @author Phil Schatzmann
+ */
+class UlpInterpreter {
+ public:
+  /// Provides the sampled value for the ADC channel or the gpio
+  typedef uint16_t (*sample_callback_t)(ulp_source_t source, uint8_t channel,
+                                        void *ref);
+
+  /// Defines the sensor callback and clears the registers and the data
+  void begin(sample_callback_t callback, void *ref = nullptr) {
+    sample_callback = callback;
+    sample_ref = ref;
+    reset();
+  }
+
+  /// Clears the registers and the data words
+  void reset() {
+    for (int j = 0; j < 4; j++) regs[j] = 0;
+    for (int j = 0; j < LOW_POWER_ULP_DATA_WORDS; j++) mem[j] = 0;
+  }
+
+  /// Executes one period of the program until halt
+  ulp_result_t run(const UlpProgram &program, uint32_t max_steps = 1000) {
+    ulp_result_t result = {false, false, 0, 0};
+    int pc = 0;
+    while (pc < program.size()) {
+      if (result.steps >= max_steps) {
+        result.is_error = true;
+        return result;
+      }
+      const ulp_op_t &op = program[pc++];
+      if (op.op == ulp_opcode_t::label) continue;
+      result.steps++;
+      result.cycles += cycles(op.op);
+      int jump_to = -1;
+      switch (op.op) {
+        case ulp_opcode_t::movi:
+          regs[op.rd] = op.imm;
+          break;
+        case ulp_opcode_t::movr:
+          regs[op.rd] = regs[op.rs];
+          break;
+        case ulp_opcode_t::addi:
+          regs[op.rd] = regs[op.rs] + op.imm;
+          break;
+        case ulp_opcode_t::addr:
+          regs[op.rd] = regs[op.rs] + regs[op.rt];
+          break;
+        case ulp_opcode_t::subr:
+          regs[op.rd] = regs[op.rs] - regs[op.rt];
+          break;
+        case ulp_opcode_t::ld: {
+          uint32_t addr = (uint32_t)regs[op.rs] + op.imm;
+          if (addr >= LOW_POWER_ULP_DATA_WORDS) return error(result);
+          regs[op.rd] = mem[addr];
+        } break;
+        case ulp_opcode_t::st: {
+          uint32_t addr = (uint32_t)regs[op.rt] + op.imm;
+          if (addr >= LOW_POWER_ULP_DATA_WORDS) return error(result);
+          mem[addr] = regs[op.rs];
+        } break;
+        case ulp_opcode_t::adc:
+          regs[op.rd] = sample(ulp_source_t::adc, op.imm);
+          break;
+        case ulp_opcode_t::gpio:
+          regs[op.rd] = sample(ulp_source_t::gpio, op.imm) ? 1 : 0;
+          break;
+        case ulp_opcode_t::jump:
+          jump_to = program.labelIdx(op.rd);
+          break;
+        case ulp_opcode_t::jump_lt:
+          if (regs[0] < op.imm) jump_to = program.labelIdx(op.rd);
+          break;
+        case ulp_opcode_t::jump_ge:
+          if (regs[0] >= op.imm) jump_to = program.labelIdx(op.rd);
+          break;
+        case ulp_opcode_t::wake:
+          // R0 contains the ready flag of the SoC
+          regs[0] = 1;
+          result.is_wakeup = true;
+          break;
+        case ulp_opcode_t::halt:
+          return result;
+        default:
+          break;
+      }
+      if (jump_to >= 0) {
+        pc = jump_to;
+      } else if (op.op >= ulp_opcode_t::jump &&
+                 op.op <= ulp_opcode_t::jump_ge && !isLabel(program, op.rd)) {
+        return error(result);
+      }
+    }
+    // the program must end with halt
+    return error(result);
+  }
+
+  /// Provides a data word (e.g. UlpProgram::value_idx)
+  uint16_t data(int idx) { return mem[idx]; }
+
+  /// Provides the value of a register
+  uint16_t reg(int idx) { return regs[idx]; }
+
+  /// Estimated number of ULP clock cycles of an instruction (8 MHz clock,
+  /// see the ESP32 technical reference manual): the ADC conversion depends
+  /// on the SAR configuration
+  static uint32_t cycles(ulp_opcode_t op) {
+    switch (op) {
+      case ulp_opcode_t::ld:
+      case ulp_opcode_t::st:
+      case ulp_opcode_t::gpio:
+        return 8;
+      case ulp_opcode_t::adc:
+        return 100;
+      case ulp_opcode_t::jump:
+      case ulp_opcode_t::jump_lt:
+      case ulp_opcode_t::jump_ge:
+        return 4;
+      case ulp_opcode_t::halt:
+        return 2;
+      case ulp_opcode_t::wake:
+        // ready check, branch and wake
+        return 18;
+      case ulp_opcode_t::label:
+        return 0;
+      default:
+        return 6;
+    }
+  }
+
+ protected:
+  uint16_t regs[4];
+  uint16_t mem[LOW_POWER_ULP_DATA_WORDS];
+  sample_callback_t sample_callback = nullptr;
+  void *sample_ref = nullptr;
+
+  uint16_t sample(ulp_source_t source, uint16_t channel) {
+    if (sample_callback == nullptr) return 0;
+    return sample_callback(source, channel, sample_ref);
+  }
+
+  static bool isLabel(const UlpProgram &program, uint8_t id) {
+    return program.labelIdx(id) >= 0;
+  }
+
+  static ulp_result_t error(ulp_result_t result) {
+    result.is_error = true;
+    return result;
+  }
+};
+
+}  // namespace low_power
@@ -0,0 +1,160 @@
+#pragma once
+
+#if defined(LOW_POWER_HOST)
+
+/**
+ * Minimal Arduino API emulation so that the LowPower library can be compiled
+ * and executed on a desktop (e.g. Linux). The time is provided by a virtual
+ * monotonic clock which only advances when we sleep or delay, so that long
+ * duty cycles can be simulated in a fraction of the real time.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#define HIGH 1
+#define LOW 0
+
+namespace low_power {
+
+/**
+ * @brief Virtual monotonic clock and pin state for the host simulation.
+ * Pin events can be injected and are applied when the clock passes their
+ * timestamp.
+ * @author Phil Schatzmann
+ */
+class HostSimulation {
+ public:
+  struct PinEvent {
+    uint64_t time_us;
+    int pin;
+    int level;
+  };
+
+  /// Provides the current virtual time in microseconds
+  uint64_t nowUs() { return now_us; }
+
+  /// Advances the virtual clock and applies the pending pin events
+  void advance(uint64_t us) { advanceTo(now_us + us); }
+
+  /// Advances the virtual clock to the indicated time
+  void advanceTo(uint64_t time_us) {
+    while (!events.empty() && events.front().time_us <= time_us) {
+      applyEvent(events.front());
+    }
+    if (time_us > now_us) now_us = time_us;
+  }
+
+  /// Schedules a pin level change at the indicated virtual time
+  void addPinEvent(int pin, int level, uint64_t time_us) {
+    PinEvent evt{time_us, pin, level};
+    auto it = events.begin();
+    while (it != events.end() && it->time_us <= time_us) it++;
+    events.insert(it, evt);
+  }
+
+  /// Schedules a pin level change relative to the current virtual time
+  void addPinEventIn(int pin, int level, uint64_t delay_us) {
+    addPinEvent(pin, level, now_us + delay_us);
+  }
+
+  /// Provides the actual level of the pin
+  int pinLevel(int pin) {
+    return (pin >= 0 && pin < max_pins) ? pin_levels[pin] : LOW;
+  }
+
+  /// Sets the level of a pin immediatly
+  void setPinLevel(int pin, int level) {
+    if (pin >= 0 && pin < max_pins) pin_levels[pin] = level;
+  }
+
+  /// Provides the pending pin events
+  std::vector<PinEvent> &pendingEvents() { return events; }
+
+  /// Reset to the initial state
+  void clear() {
+    now_us = 0;
+    events.clear();
+    memset(pin_levels, 0, sizeof(pin_levels));
+  }
+
+ protected:
+  static const int max_pins = 64;
+  uint64_t now_us = 0;
+  int pin_levels[max_pins] = {0};
+  std::vector<PinEvent> events;
+
+  void applyEvent(PinEvent evt) {
+    events.erase(events.begin());
+    if (evt.time_us > now_us) now_us = evt.time_us;
+    setPinLevel(evt.pin, evt.level);
+  }
+};
+
+/// Provides the global simulation
+inline HostSimulation &hostSimulation() {
+  static HostSimulation simulation;
+  return simulation;
+}
+
+/**
+ * @brief Serial output to stdout which can be switched off for fast
+ * simulations.
+ */
+class HostSerial {
+ public:
+  void begin(long baud = 115200) {}
+  void end() {}
+  void flush() { fflush(stdout); }
+  void setActive(bool flag) { is_active = flag; }
+  operator bool() { return true; }
+
+  void print(const char *str) {
+    if (is_active) fputs(str, stdout);
+  }
+  void print(long value) {
+    if (is_active) printf("%ld", value);
+  }
+  void println(const char *str = "") {
+    if (is_active) puts(str);
+  }
+  void println(long value) {
+    if (is_active) printf("%ld\n", value);
+  }
+
+ protected:
+  bool is_active = true;
+};
+
+}  // namespace low_power
+
+static low_power::HostSerial Serial;
+
+/// Virtual milliseconds: 32 bit like on the microcontrollers
+inline uint32_t millis() {
+  return (uint32_t)(low_power::hostSimulation().nowUs() / 1000);
+}
+
+/// Virtual microseconds: 32 bit like on the microcontrollers
+inline uint32_t micros() {
+  return (uint32_t)low_power::hostSimulation().nowUs();
+}
+
+inline void delay(uint32_t ms) {
+  low_power::hostSimulation().advance((uint64_t)ms * 1000);
+}
+
+inline void delayMicroseconds(uint32_t us) {
+  low_power::hostSimulation().advance(us);
+}
+
+inline int digitalRead(int pin) {
+  return low_power::hostSimulation().pinLevel(pin);
+}
+
+inline void pinMode(int pin, int mode) {}
+
+#endif  // LOW_POWER_HOST
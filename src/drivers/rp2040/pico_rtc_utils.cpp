@@ -44,6 +44,8 @@
 // 20231006 Created
 // 20240905 Removed clocks_init() - not available/not required
 //          in pico-sdk v2.0.0
+// 20261017 Integer epoch conversion w/o mktime()/localtime_r()
+// 20261017 pico_sleep() restores the clocks and the USB serial port
 //
 // ToDo:
 // - 
@@ -87,15 +89,17 @@ datetime_t *tm_to_datetime(struct tm *ti, datetime_t *dt)
 //     log_i("%4d-%02d-%02d %02d:%02d:%02d", ti.tm_year+1900, ti.tm_mon+1, ti.tm_mday, ti.tm_hour, ti.tm_min, ti.tm_sec);
 // }
 
-time_t datetime_to_epoch(datetime_t *dt, time_t *epoch) {
-        struct tm ti;
-        datetime_to_tm(dt, &ti);
-        
-        // Apply daylight saving time according to timezone and date
-        ti.tm_isdst = -1;
+// Offset of the local time in the RTC to UTC in seconds
+static int32_t utc_offset_s = 0;
+
+void pico_rtc_set_utc_offset(int32_t offset_s) { utc_offset_s = offset_s; }
 
-        // Convert to epoch
-        time_t _epoch = mktime(&ti);
+// The RTC contains the local time: we convert it w/o mktime() and the
+// newlib timezone and DST handling
+time_t datetime_to_epoch(datetime_t *dt, time_t *epoch) {
+        low_power::civil_time_t ct = {dt->year, dt->month, dt->day, dt->dotw,
+                                      dt->hour, dt->min, dt->sec};
+        time_t _epoch = (time_t)(low_power::civilToEpoch(ct) - utc_offset_s);
 
         if (epoch) {
           *epoch = _epoch;
@@ -105,16 +109,16 @@ time_t datetime_to_epoch(datetime_t *dt, time_t *epoch) {
 }
 
 datetime_t *epoch_to_datetime(time_t *epoch, datetime_t *dt) {
-    struct tm ti;
-
-    // Apply daylight saving time according to timezone and date
-    ti.tm_isdst = -1;
+    low_power::civil_time_t ct;
+    low_power::epochToCivil((int64_t)*epoch + utc_offset_s, ct);
 
-    // Convert epoch to struct tm
-    localtime_r(epoch, &ti);
-
-    // Convert struct tm to datetime_t
-    tm_to_datetime(&ti, dt);
+    dt->year = ct.year;
+    dt->month = ct.month;
+    dt->day = ct.day;
+    dt->dotw = ct.dotw;
+    dt->hour = ct.hour;
+    dt->min = ct.min;
+    dt->sec = ct.sec;
 
     return dt;
 }
@@ -137,9 +141,12 @@ void pico_sleep(unsigned duration) {
     //log_i("Wakeup time:");
     //print_dt(dt);
 
+    // This function does not use LowPower.sleep(): we send the pending
+    // serial data and stop the USB device before the PLLs are stopped. The
+    // UARTs keep their configuration because clk_peri is restored.
+    Serial1.flush();
+    Serial2.flush();
     Serial.flush();
-    Serial1.end();
-    Serial2.end();
     Serial.end();
 
     // From
@@ -151,12 +158,30 @@ void pico_sleep(unsigned duration) {
         USBDevice.detach();
     #endif /* USE_TINYUSB */
 
+    sleep_clock_snapshot_t clocks;
+    sleep_save_clocks(&clocks);
+    sleep_run_from_xosc();
+
+    sleep_goto_sleep_until(&dt, NULL);
+
+    // back from the sleep: restart the oscillators and the original clocks
+    sleep_power_up();
+    sleep_restore_clocks(&clocks);
+    // --8<-----
+
+    #if defined(USE_TINYUSB)
+        USBDevice.attach();
+    #endif /* USE_TINYUSB */
+    Serial.begin(115200);
+}
+#endif /* USE_TINYUSB */
+
     sleep_run_from_xosc();
 
     sleep_goto_sleep_until(&dt, NULL);
 
-    // back from dormant state
-    rosc_enable();
+    // back from dormant state: restart the oscillators and clocks
+    sleep_power_up();
     // --8<-----
 }
 #endif
@@ -54,6 +54,7 @@
 #include <hardware/rtc.h>
 #include "pico_sleep.h"
 #include "pico_rosc.h"
+#include "../../LowPowerTime.h"
 
 #ifndef PICO_RTC_UTILS_H
 #define PICO_RTC_UTILS_H
@@ -62,6 +63,8 @@ struct tm *datetime_to_tm(datetime_t *dt, struct tm *ti);
 datetime_t *tm_to_datetime(struct tm *ti, datetime_t *dt);
 time_t datetime_to_epoch(datetime_t *dt, time_t *epoch);
 datetime_t *epoch_to_datetime(time_t *epoch, datetime_t *dt);
+// Offset of the local time in the RTC to UTC (default 0: the RTC is UTC)
+void pico_rtc_set_utc_offset(int32_t offset_s);
 
 // void print_dt(datetime_t dt);
 // void print_tm(struct tm ti);
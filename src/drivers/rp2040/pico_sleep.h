@@ -9,6 +9,7 @@
 #define _PICO_SLEEP_H_
 
 #include "hardware/rtc.h"
+#include "hardware/vreg.h"
 #include "pico.h"
 
 #ifdef __cplusplus
@@ -111,6 +112,72 @@ static inline void sleep_goto_dormant_until_level_high(uint gpio_pin) {
 bool sleep_goto_sleep_for(uint32_t delay_ms,
                           hardware_alarm_callback_t callback);
 
+/*! \brief Restore the oscillators, the USB PLL and the clocks which were
+ * stopped for the sleep, so that we can continue without a reboot
+ *  \ingroup hardware_sleep
+ *
+ * The sys PLL, clk_sys and clk_peri need to be restored by the caller.
+ */
+void sleep_power_up(void);
+
+/*! \brief Clock tree and core voltage which are restored after the sleep
+ *  \ingroup hardware_sleep
+ */
+typedef struct {
+  bool is_valid;
+  uint32_t vco_hz;
+  uint post_div1;
+  uint post_div2;
+  uint32_t peri_auxsrc;
+  uint32_t peri_hz;
+  enum vreg_voltage voltage;
+} sleep_clock_snapshot_t;
+
+/*! \brief Record the sys PLL, clk_peri and the core voltage
+ *  \ingroup hardware_sleep
+ *
+ * \param snapshot The record which is filled
+ */
+void sleep_save_clocks(sleep_clock_snapshot_t *snapshot);
+
+/*! \brief Restore the recorded clocks after sleep_power_up(): the voltage is
+ * increased before the frequency
+ *  \ingroup hardware_sleep
+ *
+ * \param snapshot The record of sleep_save_clocks()
+ */
+void sleep_restore_clocks(sleep_clock_snapshot_t *snapshot);
+
+/*! \brief Send system to sleep until the delay has passed or a GPIO interrupt
+ * (e.g. defined with attachInterrupt) was raised
+ *  \ingroup hardware_sleep
+ *
+ * \param delay_ms The max sleep time
+ * \param callback Function to call on the timer wakeup.
+ */
+bool sleep_goto_sleep_for_or_gpio(uint32_t delay_ms,
+                                  hardware_alarm_callback_t callback);
+
+/*! \brief Wakeup source for sleep_goto_dormant_until_pins
+ *  \ingroup hardware_sleep
+ */
+typedef struct {
+  uint gpio;
+  bool edge;
+  bool high;
+} sleep_wakeup_pin_t;
+
+/*! \brief Send system to dormant until any of the GPIOs changes
+ *  \ingroup hardware_sleep
+ *
+ * One of the sleep_run_* functions must be called prior to this call
+ *
+ * \param pins The pins which provide the wake up
+ * \param count The number of pins
+ * \return The index of the pin which woke us up or -1
+ */
+int sleep_goto_dormant_until_pins(const sleep_wakeup_pin_t *pins, int count);
+
 #ifdef __cplusplus
 }
 #endif
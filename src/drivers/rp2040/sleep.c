@@ -14,6 +14,10 @@
 #include "hardware/pll.h"
 #include "hardware/clocks.h"
 #include "hardware/xosc.h"
+#include "hardware/vreg.h"
+#if !PICO_RP2040
+#include "hardware/structs/powman.h"
+#endif
 #include "pico_rosc.h"
 #include "hardware/regs/io_bank0.h"
 // For __wfi
@@ -137,14 +141,14 @@ void sleep_goto_sleep_until(datetime_t *t, rtc_callback_t callback) {
     __wfi();
 }
 
-bool sleep_goto_sleep_for(uint32_t delay_ms, hardware_alarm_callback_t callback)
+static bool _sleep_for(uint32_t delay_ms, hardware_alarm_callback_t callback, uint32_t sleep_en0)
 {
     // We should have already called the sleep_run_from_dormant_source function
     // This is only needed for dormancy although it saves power running from xosc while sleeping
     //assert(dormant_source_valid(_dormant_source));
 
     // Turn off all clocks except for the timer
-    clocks_hw->sleep_en0 = 0x0;
+    clocks_hw->sleep_en0 = sleep_en0;
 #if PICO_RP2040
     clocks_hw->sleep_en1 = CLOCKS_SLEEP_EN1_CLK_SYS_TIMER_BITS;
 #elif PICO_RP2350
@@ -169,10 +173,107 @@ bool sleep_goto_sleep_for(uint32_t delay_ms, hardware_alarm_callback_t callback)
 
     // Go to sleep
     __wfi();
+
+    // Release the alarm so that we can chain multiple sleeps
+    hardware_alarm_cancel(alarm_num);
+    hardware_alarm_set_callback(alarm_num, NULL);
+    hardware_alarm_unclaim(alarm_num);
     return true;
 }
 
+bool sleep_goto_sleep_for(uint32_t delay_ms, hardware_alarm_callback_t callback)
+{
+    return _sleep_for(delay_ms, callback, 0x0);
+}
+
+// Keep the IO bank clocked, so that the GPIO interrupts can wake us up as well
+bool sleep_goto_sleep_for_or_gpio(uint32_t delay_ms, hardware_alarm_callback_t callback)
+{
+    return _sleep_for(delay_ms, callback, CLOCKS_SLEEP_EN0_CLK_SYS_IO_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_PADS_BITS);
+}
+
+
+
+void sleep_save_clocks(sleep_clock_snapshot_t *snapshot) {
+    uint32_t refdiv = pll_sys_hw->cs & PLL_CS_REFDIV_BITS;
+    uint32_t fbdiv = pll_sys_hw->fbdiv_int & PLL_FBDIV_INT_BITS;
+    uint32_t prim = pll_sys_hw->prim;
+    snapshot->vco_hz = XOSC_MHZ * MHZ / refdiv * fbdiv;
+    snapshot->post_div1 = (prim & PLL_PRIM_POSTDIV1_BITS) >> PLL_PRIM_POSTDIV1_LSB;
+    snapshot->post_div2 = (prim & PLL_PRIM_POSTDIV2_BITS) >> PLL_PRIM_POSTDIV2_LSB;
+    snapshot->peri_auxsrc = (clocks_hw->clk[clk_peri].ctrl & CLOCKS_CLK_PERI_CTRL_AUXSRC_BITS) >> CLOCKS_CLK_PERI_CTRL_AUXSRC_LSB;
+    snapshot->peri_hz = clock_get_hz(clk_peri);
+#if PICO_RP2040
+    snapshot->voltage = (enum vreg_voltage)((vreg_and_chip_reset_hw->vreg & VREG_AND_CHIP_RESET_VREG_VSEL_BITS) >> VREG_AND_CHIP_RESET_VREG_VSEL_LSB);
+#else
+    snapshot->voltage = (enum vreg_voltage)((powman_hw->vreg & POWMAN_VREG_VSEL_BITS) >> POWMAN_VREG_VSEL_LSB);
+#endif
+    snapshot->is_valid = true;
+}
+
+void sleep_restore_clocks(sleep_clock_snapshot_t *snapshot) {
+    if (!snapshot->is_valid) return;
+    vreg_set_voltage(snapshot->voltage);
+    busy_wait_us(100);
+    set_sys_clock_pll(snapshot->vco_hz, snapshot->post_div1, snapshot->post_div2);
+    clock_configure(clk_peri, 0, snapshot->peri_auxsrc, snapshot->peri_hz, snapshot->peri_hz);
+    snapshot->is_valid = false;
+}
+
+// Bring the system back after a sleep or dormant without a reboot: the caller
+// is responsible to restore clk_sys (and clk_peri) with the sys PLL
+void sleep_power_up(void) {
+    // Disable the deep sleep at the proc, so that a normal __wfi does not stop the clocks
+#ifdef __riscv
+    riscv_clear_csr(RVCSR_MSLEEP_OFFSET, RVCSR_MSLEEP_POWERDOWN_BITS | RVCSR_MSLEEP_DEEPSLEEP_BITS);
+#else
+    scb_hw->scr &= ~ARM_CPU_PREFIXED(SCR_SLEEPDEEP_BITS);
+#endif
+
+    // Re-enable all clocks in sleep mode (reset value)
+    clocks_hw->sleep_en0 = 0xffffffff;
+    clocks_hw->sleep_en1 = 0xffffffff;
+
+    // Restart the oscillator which was switched off by sleep_run_from_dormant_source
+    if (_dormant_source == DORMANT_SOURCE_XOSC) {
+        rosc_enable();
+    } else if (_dormant_source == DORMANT_SOURCE_ROSC) {
+        xosc_init();
+    }
 
+    // CLK_REF = XOSC
+    clock_configure(clk_ref,
+                    CLOCKS_CLK_REF_CTRL_SRC_VALUE_XOSC_CLKSRC,
+                    0,
+                    XOSC_MHZ * MHZ,
+                    XOSC_MHZ * MHZ);
+
+    // the USB PLL provides the 48MHz for USB and ADC
+    if (_dormant_source != DORMANT_SOURCE_NONE) {
+        pll_init(pll_usb, 1, 480 * MHZ, 5, 2);
+
+        clock_configure(clk_usb,
+                        0,
+                        CLOCKS_CLK_USB_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+                        48 * MHZ,
+                        48 * MHZ);
+
+        clock_configure(clk_adc,
+                        0,
+                        CLOCKS_CLK_ADC_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+                        48 * MHZ,
+                        48 * MHZ);
+#if PICO_RP2040
+        // CLK RTC = PLL USB (48MHz) / 1024 = 46875Hz
+        clock_configure(clk_rtc,
+                        0,
+                        CLOCKS_CLK_RTC_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+                        48 * MHZ,
+                        46875);
+#endif
+    }
+    _dormant_source = DORMANT_SOURCE_NONE;
+}
 
 static void _go_dormant(void) {
     assert(dormant_source_valid(_dormant_source));
@@ -206,4 +307,32 @@ void sleep_goto_dormant_until_pin(uint gpio_pin, bool edge, bool high) {
     // Clear the irq so we can go back to dormant mode again if we want
     gpio_acknowledge_irq(gpio_pin, event);
 }
+
+static uint32_t _dormant_event(bool edge, bool high) {
+    if (edge) return high ? IO_BANK0_DORMANT_WAKE_INTE0_GPIO0_EDGE_HIGH_BITS : IO_BANK0_DORMANT_WAKE_INTE0_GPIO0_EDGE_LOW_BITS;
+    return high ? IO_BANK0_DORMANT_WAKE_INTE0_GPIO0_LEVEL_HIGH_BITS : IO_BANK0_DORMANT_WAKE_INTE0_GPIO0_LEVEL_LOW_BITS;
+}
+
+int sleep_goto_dormant_until_pins(const sleep_wakeup_pin_t *pins, int count) {
+    for (int j = 0; j < count; j++) {
+        assert(pins[j].gpio < NUM_BANK0_GPIOS);
+        gpio_set_dormant_irq_enabled(pins[j].gpio, _dormant_event(pins[j].edge, pins[j].high), true);
+    }
+
+    _go_dormant();
+    // Execution stops here until woken up
+
+    // Determine the pin from the dormant wake status and clear the irqs
+    int result = -1;
+    io_irq_ctrl_hw_t *irq_ctrl = &io_bank0_hw->dormant_wake_irq_ctrl;
+    for (int j = 0; j < count; j++) {
+        uint gpio = pins[j].gpio;
+        uint32_t event = _dormant_event(pins[j].edge, pins[j].high);
+        uint32_t status = irq_ctrl->ints[gpio / 8] >> (4 * (gpio % 8));
+        if (result < 0 && (status & event)) result = j;
+        gpio_set_dormant_irq_enabled(gpio, event, false);
+        gpio_acknowledge_irq(gpio, event);
+    }
+    return result;
+}
 #endif /* ARDUINO_ARCH_RP2040 */
@@ -2,6 +2,13 @@
 
 #include "samd.h"
 
+// instance which receives the ADC window interrupt
+static ArduinoLowPowerClass *adc_owner = nullptr;
+// callback of the RTC alarm
+static voidFuncPtr rtc_cb = nullptr;
+// the RTC counts with 1024 Hz: we keep a margin for the wrap around
+static const uint32_t RTC_MAX_TICKS = 0xFFFFFF00;
+
 static void configGCLK6()
 {
 	// enable EIC clock
@@ -35,14 +42,8 @@ void ArduinoLowPowerClass::idle(uint32_t millis) {
 	idle();
 }
 
+// The USB device is suspended by the peripheral hooks (see LowPowerSAMD.h)
 void ArduinoLowPowerClass::sleep() {
-	bool restoreUSBDevice = false;
-	if (SERIAL_PORT_USBVIRTUAL) {
-		USBDevice.standby();
-	} else {
-		USBDevice.detach();
-		restoreUSBDevice = true;
-	}
 	// Disable systick interrupt:  See https://www.avrfreaks.net/forum/samd21-samd21e16b-sporadically-locks-and-does-not-wake-standby-sleep-mode
 	SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;	
 	SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
@@ -50,9 +51,6 @@ void ArduinoLowPowerClass::sleep() {
 	__WFI();
 	// Enable systick interrupt
 	SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;	
-	if (restoreUSBDevice) {
-		USBDevice.attach();
-	}
 }
 
 void ArduinoLowPowerClass::sleep(uint32_t millis) {
@@ -68,15 +66,62 @@ void ArduinoLowPowerClass::deepSleep(uint32_t millis) {
 	sleep(millis);
 }
 
+void ArduinoLowPowerClass::configRTC() {
+	// enable the RTC bus clock
+	PM->APBAMASK.reg |= PM_APBAMASK_RTC;
+
+	// GCLK2 runs from OSCULP32K also in standby
+	GCLK->GENDIV.reg = GCLK_GENDIV_ID(2) | GCLK_GENDIV_DIV(0);
+	while (GCLK->STATUS.bit.SYNCBUSY);
+	GCLK->GENCTRL.reg = (GCLK_GENCTRL_GENEN | GCLK_GENCTRL_SRC_OSCULP32K | GCLK_GENCTRL_ID(2) | GCLK_GENCTRL_RUNSTDBY);
+	while (GCLK->STATUS.bit.SYNCBUSY);
+	GCLK->CLKCTRL.reg = (uint16_t) (GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK2 | GCLK_CLKCTRL_ID(GCM_RTC));
+	while (GCLK->STATUS.bit.SYNCBUSY);
+
+	// reset the RTC
+	RTC->MODE0.CTRL.reg &= ~RTC_MODE0_CTRL_ENABLE;
+	while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+	RTC->MODE0.CTRL.reg |= RTC_MODE0_CTRL_SWRST;
+	while (RTC->MODE0.STATUS.bit.SYNCBUSY || (RTC->MODE0.CTRL.reg & RTC_MODE0_CTRL_SWRST));
+
+	// 32 bit counter with 32768 / 32 = 1024 Hz
+	RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_MODE_COUNT32 | RTC_MODE0_CTRL_PRESCALER_DIV32;
+	while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+
+	// continuous read synchronization: COUNT can be read w/o waiting
+	RTC->MODE0.READREQ.reg = RTC_READREQ_RCONT | RTC_READREQ_RREQ | RTC_READREQ_ADDR(0x10);
+	while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+
+	RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+	RTC->MODE0.INTENSET.reg = RTC_MODE0_INTENSET_CMP0;
+	NVIC_EnableIRQ(RTC_IRQn);
+	NVIC_SetPriority(RTC_IRQn, 0);
+
+	RTC->MODE0.CTRL.reg |= RTC_MODE0_CTRL_ENABLE;
+	while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+
+	rtc_configured = true;
+}
+
+uint32_t ArduinoLowPowerClass::rtcTicks() {
+	if (!rtc_configured) configRTC();
+	return RTC->MODE0.COUNT.reg;
+}
+
 void ArduinoLowPowerClass::setAlarmIn(uint32_t millis) {
 
-	if (!rtc.isConfigured()) {
+	if (!rtc_configured) {
 		attachInterruptWakeup(RTC_ALARM_WAKEUP, NULL, (irq_mode)0);
 	}
 
-	uint32_t now = rtc.getEpoch();
-	rtc.setAlarmEpoch(now + millis/1000);
-	rtc.enableAlarm(rtc.MATCH_YYMMDDHHMMSS);
+	// relative alarm: we only need the current counter value
+	uint64_t ticks = ((uint64_t)millis * 1024 + 500) / 1000;
+	// the compare register is synchronized to the RTC clock
+	if (ticks < 2) ticks = 2;
+	if (ticks > RTC_MAX_TICKS) ticks = RTC_MAX_TICKS;
+	RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+	RTC->MODE0.COMP[0].reg = RTC->MODE0.COUNT.reg + (uint32_t)ticks;
+	while (RTC->MODE0.STATUS.bit.SYNCBUSY);
 }
 
 void ArduinoLowPowerClass::attachInterruptWakeup(uint32_t pin, voidFuncPtr callback, irq_mode mode) {
@@ -86,8 +131,8 @@ void ArduinoLowPowerClass::attachInterruptWakeup(uint32_t pin, voidFuncPtr callb
 		// RTC library should call this API to enable the alarm subsystem
 		switch (pin) {
 			case RTC_ALARM_WAKEUP:
-				rtc.begin(false);
-				rtc.attachInterrupt(callback);
+				if (!rtc_configured) configRTC();
+				rtc_cb = callback;
 			/*case UART_WAKEUP:*/
 		}
 		return;
@@ -119,6 +164,7 @@ void ArduinoLowPowerClass::attachAdcInterrupt(uint32_t pin, voidFuncPtr callback
 	}
 
 	adc_cb = callback;
+	adc_owner = this;
 
 	configGCLK6();
 
@@ -129,8 +175,24 @@ void ArduinoLowPowerClass::attachAdcInterrupt(uint32_t pin, voidFuncPtr callback
 						| GCLK_CLKCTRL_CLKEN;
 	while (GCLK->STATUS.bit.SYNCBUSY) {}
 
-	// Set ADC prescaler as low as possible
-	ADC->CTRLB.bit.PRESCALER = ADC_CTRLB_PRESCALER_DIV4;
+	// Disable the ADC while we change the configuration
+	ADC->CTRLA.bit.ENABLE = 0;
+	while (ADC->STATUS.bit.SYNCBUSY) {}
+
+	// Set ADC prescaler and the sampling time for the requested sample rate
+	ADC->CTRLB.bit.PRESCALER = adc_prescaler;
+	while (ADC->STATUS.bit.SYNCBUSY) {}
+	ADC->SAMPCTRL.reg = ADC_SAMPCTRL_SAMPLEN(adc_samplen);
+
+	// Averaging needs the 16 bit result: we adjust it back to 12 bits
+	if (adc_samplenum > 0) {
+		ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_16BIT_Val;
+		ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM(adc_samplenum)
+							| ADC_AVGCTRL_ADJRES(adc_samplenum);
+	} else {
+		ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_12BIT_Val;
+		ADC->AVGCTRL.reg = 0;
+	}
 	while (ADC->STATUS.bit.SYNCBUSY) {}
 
 	// Configure window mode
@@ -140,6 +202,7 @@ void ArduinoLowPowerClass::attachAdcInterrupt(uint32_t pin, voidFuncPtr callback
 	while (ADC->STATUS.bit.SYNCBUSY) {}
 
 	// Enable window interrupt
+	ADC->INTFLAG.reg = ADC_INTFLAG_WINMON;
 	ADC->INTENSET.bit.WINMON = 1;
 	while (ADC->STATUS.bit.SYNCBUSY) {}
 
@@ -181,7 +244,7 @@ void ArduinoLowPowerClass::detachAdcInterrupt()
 	while (ADC->STATUS.bit.SYNCBUSY) {}
 
 	// Disable ADC in standby mode
-	ADC->CTRLA.bit.RUNSTDBY = 1;
+	ADC->CTRLA.bit.RUNSTDBY = 0;
 	while (ADC->STATUS.bit.SYNCBUSY) {}
 
 	// Disable window interrupt
@@ -192,8 +255,11 @@ void ArduinoLowPowerClass::detachAdcInterrupt()
 	ADC->WINCTRL.reg = ADC_WINCTRL_WINMODE_DISABLE;
 	while (ADC->STATUS.bit.SYNCBUSY) {}
 
-	// Restore ADC prescaler
+	// Restore ADC prescaler, sampling time and resolution of the core
 	ADC->CTRLB.bit.PRESCALER = ADC_CTRLB_PRESCALER_DIV512_Val;
+	ADC->CTRLB.bit.RESSEL = ADC_CTRLB_RESSEL_10BIT_Val;
+	ADC->AVGCTRL.reg = 0;
+	ADC->SAMPCTRL.reg = ADC_SAMPCTRL_SAMPLEN(0x3f);
 	while (ADC->STATUS.bit.SYNCBUSY) {}
 
 	// Restore ADC clock
@@ -204,14 +270,54 @@ void ArduinoLowPowerClass::detachAdcInterrupt()
 	while (GCLK->STATUS.bit.SYNCBUSY) {}
 
 	adc_cb = nullptr;
+	adc_owner = nullptr;
+}
+
+void ArduinoLowPowerClass::setAdcSampling(uint8_t prescaler, uint8_t samplen, uint8_t samplenum)
+{
+	adc_prescaler = prescaler & 0x7;
+	adc_samplen = samplen & 0x3f;
+	adc_samplenum = samplenum > 4 ? 4 : samplenum;
+}
+
+void ArduinoLowPowerClass::rearmAdcInterrupt()
+{
+	if (adc_cb == nullptr) return;
+	ADC->INTFLAG.reg = ADC_INTFLAG_WINMON;
+	ADC->INTENSET.bit.WINMON = 1;
+}
+
+void ArduinoLowPowerClass::adcInterrupt()
+{
+	// Clear the interrupt flag
+	ADC->INTFLAG.reg = ADC_INTFLAG_WINMON;
+	// The free running ADC would trigger again with each conversion while
+	// the condition is met: we wait for rearmAdcInterrupt()
+	ADC->INTENCLR.bit.WINMON = 1;
+	if (adc_owner != nullptr && adc_owner->adc_cb != nullptr)
+		adc_owner->adc_cb();
+}
+
+void ArduinoLowPowerClass::rtcInterrupt()
+{
+	// Clear the interrupt flag
+	RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+	if (rtc_cb != nullptr) rtc_cb();
 }
 
-// void ADC_Handler()
-// {
-// 	// Clear the interrupt flag
-// 	ADC->INTFLAG.bit.WINMON = 1;
-// 	LowPower.adc_cb();
-// }
+#if LOW_POWER_SAMD_ADC_HANDLER
+void ADC_Handler()
+{
+	ArduinoLowPowerClass::adcInterrupt();
+}
+#endif
+
+#if LOW_POWER_SAMD_RTC_HANDLER
+void RTC_Handler(void)
+{
+	ArduinoLowPowerClass::rtcInterrupt();
+}
+#endif
 
 // ArduinoLowPowerClass LowPower;
 
@@ -2,15 +2,12 @@
 #define _ARDUINO_LOW_POWER_H_
 
 #include <Arduino.h>
+#include "../../LowPowerConfig.h"
 
 #ifdef ARDUINO_ARCH_AVR
 #error The library is not compatible with AVR boards
 #endif
 
-#ifdef ARDUINO_ARCH_SAMD
-#include "RTCZero.h"
-#endif
-
 #if defined(ARDUINO_SAMD_TIAN) || defined(ARDUINO_NRF52_PRIMO)
 // add here any board with companion chip which can be woken up
 #define BOARD_HAS_COMPANION_CHIP
@@ -87,14 +84,29 @@ class ArduinoLowPowerClass {
 		#ifdef ARDUINO_ARCH_SAMD
 		void attachAdcInterrupt(uint32_t pin, voidFuncPtr callback, adc_interrupt mode, uint16_t lo, uint16_t hi);
 		void detachAdcInterrupt();
+		// prescaler: 0 (DIV4) - 7 (DIV512) of the 32 kHz clock, samplen: 0 - 63, samplenum: log2 of the averaged samples 0 - 4
+		void setAdcSampling(uint8_t prescaler, uint8_t samplen, uint8_t samplenum);
+		// enables the window interrupt again after it was triggered
+		void rearmAdcInterrupt();
+		// RTC counter with 1024 ticks per second which also runs in standby
+		uint32_t rtcTicks();
+		// interrupt processing: call them from your own RTC_Handler() and
+		// ADC_Handler() if LOW_POWER_SAMD_RTC_HANDLER or
+		// LOW_POWER_SAMD_ADC_HANDLER is 0
+		static void rtcInterrupt();
+		static void adcInterrupt();
 		#endif
 
 	private:
 		void setAlarmIn(uint32_t millis);
 		#ifdef ARDUINO_ARCH_SAMD
-		RTCZero rtc;
-		voidFuncPtr adc_cb;
-		friend void ADC_Handler();
+		// RTC counter (mode 0) with 1024 ticks per second
+		void configRTC();
+		bool rtc_configured = false;
+		voidFuncPtr adc_cb = nullptr;
+		uint8_t adc_prescaler = 0;
+		uint8_t adc_samplen = 0;
+		uint8_t adc_samplenum = 0;
 		#endif
 		#ifdef BOARD_HAS_COMPANION_CHIP
 		void (*companionSleepCB)(bool);